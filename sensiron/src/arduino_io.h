@@ -0,0 +1,37 @@
+#ifndef ARDUINO_IO_H
+#define ARDUINO_IO_H
+#include <Arduino.h>
+#include <PubSubClient.h>
+
+#include "pipeline_io.h"
+
+// The pipeline's clock on the Arduino core.
+class ArduinoClock : public Clock {
+public:
+    unsigned long millis() override { return ::millis(); }
+    uint32_t micros() override { return ::micros(); }
+    // The cores take it from the hardware random number generator.
+    long random() override { return ::random(0x7fffffff); }
+};
+
+// PubSubClient as the pipeline's MQTT client.
+class PubSubMqttClient : public MqttClient {
+public:
+    PubSubMqttClient(PubSubClient& client) : _client(client) {}
+
+    void setServer(const char* host, uint16_t port) override { _client.setServer(host, port); }
+    bool connect(const char* clientId) override { return _client.connect(clientId); }
+    bool connected() override { return _client.connected(); }
+    bool loop() override { return _client.loop(); }
+    void disconnect() override { _client.disconnect(); }
+    bool publish(const char* topic, const uint8_t* payload, size_t length, bool retained) override {
+        return _client.publish(topic, payload, length, retained);
+    }
+    bool subscribe(const char* topic) override { return _client.subscribe(topic); }
+    bool unsubscribe(const char* topic) override { return _client.unsubscribe(topic); }
+    int state() override { return _client.state(); }
+
+private:
+    PubSubClient& _client;
+};
+#endif
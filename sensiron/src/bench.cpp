@@ -0,0 +1,168 @@
+#include "bench.h"
+
+#ifdef ENABLE_BENCH
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "platform_compat.h"
+#else
+#include <time.h>
+#endif
+
+static volatile uint32_t allocations = 0;
+static BenchStats* benchList = nullptr;
+// Idle time since the report at reportStart, in milliseconds.
+static uint32_t idleTime = 0;
+static uint32_t reportStart = 0;
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void* __real_calloc(size_t count, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+}
+
+#ifdef ARDUINO
+static uint32_t ticks() { return ESP.getCycleCount(); }
+static uint32_t tickHz() { return ESP.getCpuFreqMHz() * 1000000UL; }
+static uint32_t freeHeap() { return ESP.getFreeHeap(); }
+static uint32_t maxFreeBlock() { return platformMaxFreeBlock(); }
+// Low water mark of the loop stack, of the calling task's stack on the ESP32.
+static uint32_t freeStack() { return platformFreeStack(); }
+static uint32_t milliseconds() { return millis(); }
+static void output(const char* text) { Serial.print(text); }
+#else
+static uint32_t ticks() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+static uint32_t tickHz() { return 1000000000UL; }
+static uint32_t freeHeap() { return 0; }
+static uint32_t maxFreeBlock() { return 0; }
+static uint32_t freeStack() { return 0; }
+static uint32_t milliseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000ULL + now.tv_nsec / 1000000);
+}
+static void output(const char* text) { fputs(text, stdout); }
+#endif
+
+uint32_t benchAllocations() {
+    return allocations;
+}
+
+void benchIdle(uint32_t milliseconds) {
+    idleTime += milliseconds;
+}
+
+BenchMemory::BenchMemory() {
+    minBefore = UINT32_MAX;
+    minAfter = UINT32_MAX;
+    maxDrop = INT32_MIN;
+}
+
+void BenchMemory::add(uint32_t before, uint32_t after) {
+    int32_t drop = (int32_t) (before - after);
+
+    if (before < minBefore) {
+        minBefore = before;
+    }
+    if (after < minAfter) {
+        minAfter = after;
+    }
+    if (drop > maxDrop) {
+        maxDrop = drop;
+    }
+}
+
+BenchStats::BenchStats(const char* name) : name(name) {
+    runs = 0;
+    totalTicks = 0;
+    maxTicks = 0;
+    this->allocations = 0;
+    next = benchList;
+    benchList = this;
+}
+
+// The memory figures are read before the clock starts, so reading them is
+// not timed.
+BenchScope::BenchScope(BenchStats& stats) : _stats(stats) {
+    _freeHeap = freeHeap();
+    _maxFreeBlock = maxFreeBlock();
+    _freeStack = freeStack();
+    _allocations = allocations;
+    _start = ticks();
+}
+
+BenchScope::~BenchScope() {
+    uint32_t elapsed = ticks() - _start;
+
+    _stats.runs++;
+    _stats.totalTicks += elapsed;
+    if (elapsed > _stats.maxTicks) {
+        _stats.maxTicks = elapsed;
+    }
+    _stats.allocations += allocations - _allocations;
+    _stats.freeHeap.add(_freeHeap, freeHeap());
+    _stats.maxFreeBlock.add(_maxFreeBlock, maxFreeBlock());
+    _stats.freeStack.add(_freeStack, freeStack());
+}
+
+void benchReport() {
+    char line[320];
+    bool first = true;
+
+    uint32_t now = milliseconds();
+    uint32_t elapsed = now - reportStart;
+    double duty = 1.0;
+
+    if (elapsed > 0) {
+        duty = idleTime < elapsed ? 1.0 - (double) idleTime / elapsed : 0.0;
+    }
+
+    snprintf(line, sizeof(line), "{\"tick_hz\":%lu,\"awake_duty\":%.3f,\"bench\":[", (unsigned long) tickHz(), duty);
+    output(line);
+    reportStart = now;
+    idleTime = 0;
+    for (BenchStats* stats = benchList; stats; stats = stats->next) {
+        if (stats->runs == 0) {
+            continue;
+        }
+        const BenchMemory& heap = stats->freeHeap;
+        const BenchMemory& block = stats->maxFreeBlock;
+        const BenchMemory& stack = stats->freeStack;
+        snprintf(line, sizeof(line),
+                 "%s{\"name\":\"%s\",\"runs\":%lu,\"avg_ticks\":%lu,\"max_ticks\":%lu,"
+                 "\"allocs_per_run\":%.2f,\"free_heap\":[%lu,%lu,%ld],\"max_block\":[%lu,%lu,%ld],"
+                 "\"free_stack\":[%lu,%lu,%ld]}",
+                 first ? "" : ",", stats->name, (unsigned long) stats->runs, (unsigned long) (stats->totalTicks / stats->runs),
+                 (unsigned long) stats->maxTicks, (double) stats->allocations / stats->runs,
+                 (unsigned long) heap.minBefore, (unsigned long) heap.minAfter, (long) heap.maxDrop,
+                 (unsigned long) block.minBefore, (unsigned long) block.minAfter, (long) block.maxDrop,
+                 (unsigned long) stack.minBefore, (unsigned long) stack.minAfter, (long) stack.maxDrop);
+        output(line);
+        first = false;
+    }
+    output("]}\n");
+}
+
+#endif
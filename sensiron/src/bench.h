@@ -0,0 +1,68 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <stdint.h>
+
+// Build with -DENABLE_BENCH (see the *_bench environments) to measure the
+// hot paths wrapped in BENCH_SCOPE. Per scope the number of runs, total and
+// worst time and heap allocations (counted by wrapping malloc/realloc/calloc
+// at link time) are collected. Free heap, largest free block and free stack
+// are read before and after every run, the report gives each as [lowest
+// before, lowest after, largest drop over one run]. benchReport() prints
+// them as one line of JSON. On the device time is in cpu cycles, on the host in nanoseconds,
+// tick_hz in the report gives the rate. Time the loop sleeps is reported with
+// BENCH_IDLE, awake_duty is the share of the time since the previous report
+// the cpu was awake.
+#ifdef ENABLE_BENCH
+// One of the memory figures of a scope, the drop is negative when every run
+// freed memory.
+struct BenchMemory {
+    BenchMemory();
+    void add(uint32_t before, uint32_t after);
+
+    uint32_t minBefore;
+    uint32_t minAfter;
+    int32_t maxDrop;
+};
+
+struct BenchStats {
+    BenchStats(const char* name);
+
+    const char* name;
+    uint32_t runs;
+    uint64_t totalTicks;
+    uint32_t maxTicks;
+    uint32_t allocations;
+    BenchMemory freeHeap;
+    BenchMemory maxFreeBlock;
+    BenchMemory freeStack;
+    BenchStats* next;
+};
+
+class BenchScope {
+public:
+    BenchScope(BenchStats& stats);
+    ~BenchScope();
+
+private:
+    BenchStats& _stats;
+    uint32_t _allocations;
+    uint32_t _freeHeap;
+    uint32_t _maxFreeBlock;
+    uint32_t _freeStack;
+    uint32_t _start;
+};
+
+uint32_t benchAllocations();
+void benchIdle(uint32_t milliseconds);
+void benchReport();
+
+#define BENCH_SCOPE(name) \
+    static BenchStats benchStats(name); \
+    BenchScope benchScope(benchStats)
+#define BENCH_IDLE(milliseconds) benchIdle(milliseconds)
+#else
+#define BENCH_SCOPE(name)
+#define BENCH_IDLE(milliseconds)
+#endif
+
+#endif
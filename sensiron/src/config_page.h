@@ -0,0 +1,46 @@
+#ifndef CONFIG_PAGE_H
+#define CONFIG_PAGE_H
+#include "page_template.h"
+
+// The settings page served on / and /get, rendered by renderTemplate(). The
+// placeholders are expanded in main.cpp, rows repeated per sensor field or
+// option are expanded one at a time. The maxlength of the text inputs is the
+// size of their Settings field less the terminator.
+static const char CONFIG_PAGE[] PROGMEM = R"rawliteral(<!DOCTYPE HTML><html><head>
+<title>Environmental Sensor</title>
+<meta name="viewport" content="width=device-width, initial-scale=1">
+</head><body>
+%ERROR%
+<form action="/get">
+<input type="text" name="Mqtt topic" maxlength="95" value="%TOPIC%"><label for="Mqtt topic"> MQTT Topic</label><br>
+<input type="text" name="Mqtt Server" maxlength="63" value="%SERVER%"><label for="Mqtt Server"> MQTT Server IP</label><br>
+<input type="number" name="Mqtt port" min="1" max="65535" value="%PORT%"><label for="Mqtt port"> MQTT Server Port</label><br>
+<input type="checkbox" name="mqtt_enabled" value="Yes"%MQTT_CHECKED%><label for="mqtt_enabled"> MQTT Enabled</label><br>
+<input type="number" name="Publish interval" min="1" max="3600" value="%PUBLISH_INTERVAL%"><label for="Publish interval"> Publish interval (s)</label><br>
+<h2>Report by exception</h2>
+<input type="number" name="Heartbeat" min="10" max="86400" value="%HEARTBEAT%"><label for="Heartbeat"> Heartbeat (s)</label><br>
+%DEADBANDS%
+<h2>Batching</h2>
+<input type="number" name="Batch size" min="0" max="%BATCH_MAX%" value="%BATCH_SIZE%"><label for="Batch size"> Samples per batch (0: publish every window)</label><br>
+<select name="Batch encoding">%BATCH_ENCODINGS%</select><label for="Batch encoding"> Batch encoding</label><br>
+<h2>Power</h2>
+<select name="Power mode">%POWER_MODES%</select><label for="Power mode"> Power mode</label><br>
+<h2>Sensor</h2>
+<input type="number" name="Warm start" min="0" max="65535" value="%WARM_START%"><label for="Warm start"> Temperature warm start (0-65535)</label><br>
+<select name="RHT acceleration">%RHT_ACCELERATIONS%</select><label for="RHT acceleration"> RHT acceleration</label><br>
+<br>
+<input type="submit" value="Submit">
+</form><br>
+<h1 class="label">MQTT Config</h1>
+MQTT Topic: %TOPIC%<br>
+MQTT Server: %SERVER%<br>
+MQTT Port: %PORT%<br>
+MQTT Enabled: %MQTT_ENABLED%<br>
+Publish interval: %PUBLISH_INTERVAL% s<br>
+Heartbeat: %HEARTBEAT% s<br>
+<p><a href="/data">Json sensor data</a></p>
+<p><a href="/history?field=pm2p5&amp;res=1m">PM2.5 history</a></p><br>
+</body></html>
+)rawliteral";
+
+#endif
@@ -1,203 +1,96 @@
-
-
-#include <Arduino.h>
-#include <ArduinoJson.h>
+#include <stdio.h>
+#include <string.h>
 #include "ha_discovery.h"
 
-HaDiscovery::HaDiscovery(String stateTopic) {
-	_stateTopic = stateTopic;
+// Copies src to dst escaping the characters json does not allow in strings.
+static void copyJsonEscaped(char* dst, size_t size, const char* src) {
+    size_t pos = 0;
+
+    for (; *src && pos + 2 < size; src++) {
+        if (*src == '"' || *src == '\\') {
+            dst[pos++] = '\\';
+        } else if ((unsigned char) *src < 0x20) {
+            continue;
+        }
+        dst[pos++] = *src;
+    }
+    dst[pos] = '\0';
+}
+
+// 32 bit FNV-1a, continuing from hash.
+static uint32_t fnv1a(uint32_t hash, const char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) data[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+HaDiscovery::HaDiscovery(const char* stateTopic, uint32_t chipId, uint8_t sensor) {
+    copyJsonEscaped(_stateTopic, sizeof(_stateTopic), stateTopic);
+    if (sensor == 0) {
+        snprintf(_nodeId, sizeof(_nodeId), "%u", (unsigned) chipId);
+    } else {
+        snprintf(_nodeId, sizeof(_nodeId), "%u_%u", (unsigned) chipId, sensor);
+    }
     setDeviceInfo("NA", "NA", "NA");
 }
 
-void HaDiscovery::setDeviceInfo(String serialNumber, String hw_version, String sw_version) {
-    _devDoc["ids"] = serialNumber; //identifiers
-    _devDoc["mf"] = "Sham(Sensirion)"; //manufacturer
-    _devDoc["mdl"] = "SEN55";  //model
-    _devDoc["name"] = "Sensirion SEN55";
-    _devDoc["hw"] = hw_version; //hw_version
-    _devDoc["sw"] = sw_version; //sw_version
-}
-
-String HaDiscovery::getDiscoveryTopicPm1p0() {
-    int sensorNumber = ESP.getChipId();
-    return "homeassistant/sensor/env_sensor_" + String(sensorNumber) + "/pm1p0/config";
-}
-
-JsonDocument HaDiscovery::getMQTTPm1p0DiscoveryMsg() {
-    // My numeric sensor ID, you can change this to whatever suits your needs
-    int sensorNumber = ESP.getChipId();
-    JsonDocument doc;
-    
-
-    doc["name"] = "Env " + String(sensorNumber) + " Pm1p0";
-    doc["stat_t"]   = _stateTopic;
-    doc["unit_of_meas"]   = "μg/mᵌ";
-    doc["sug_dsp_prc"] = 2; //         'suggested_display_precision',
-    doc["frc_upd"] = true;
-    doc["val_tpl"] = "{{ value_json.pm1p0|default(0) }}";
-    doc["uniq_id"] = String(ESP.getChipId()) + "_pm1p0";
-    doc["device"] = _devDoc;
-
-    return doc;
-}
-
-String HaDiscovery::getDiscoveryTopicPm2p5() {
-    int sensorNumber = ESP.getChipId();
-    return "homeassistant/sensor/env_sensor_" + String(sensorNumber) + "/pm2p5/config";
-}
-
-JsonDocument HaDiscovery::getMQTTPm2p5DiscoveryMsg() {
-    // My numeric sensor ID, you can change this to whatever suits your needs
-    int sensorNumber = ESP.getChipId();
-    JsonDocument doc;
-
-    doc["name"] = "Env " + String(sensorNumber) + " Pm2p5";
-    doc["stat_t"]   = _stateTopic;
-    doc["unit_of_meas"]   = "μg/mᵌ";
-    doc["sug_dsp_prc"] = 2; //         'suggested_display_precision',
-    doc["frc_upd"] = true;
-    doc["val_tpl"] = "{{ value_json.pm2p5|default(0) }}";
-
-    doc["uniq_id"] = String(ESP.getChipId()) + "_pm2p5";
-    doc["device"] = _devDoc;
-
-    return doc;
-}
-
-String HaDiscovery::getDiscoveryTopicPm4p0() {
-    int sensorNumber = ESP.getChipId();
-    return "homeassistant/sensor/env_sensor_" + String(sensorNumber) + "/pm4p0/config";
-}
-
-JsonDocument HaDiscovery::getMQTTPm4p0DiscoveryMsg() {
-    // My numeric sensor ID, you can change this to whatever suits your needs
-    int sensorNumber = ESP.getChipId();
-    JsonDocument doc;
-
-    doc["name"] = "Env " + String(sensorNumber) + " Pm4p0";
-    doc["stat_t"]   = _stateTopic;
-    doc["unit_of_meas"]   = "μg/mᵌ";
-    doc["sug_dsp_prc"] = 2; //         'suggested_display_precision',
-    doc["frc_upd"] = true;
-    doc["val_tpl"] = "{{ value_json.pm4p0|default(0) }}";
-
-    doc["uniq_id"] = String(ESP.getChipId()) + "_pm4p0";;
-    doc["device"] = _devDoc;
-
-    return doc;
-}
-
-String HaDiscovery::getDiscoveryTopicPm10p0() {
-    int sensorNumber = ESP.getChipId();
-    return "homeassistant/sensor/env_sensor_" + String(sensorNumber) + "/pm10p0/config";
-}
-
-JsonDocument HaDiscovery::getMQTTPm10p0DiscoveryMsg() {
-    // My numeric sensor ID, you can change this to whatever suits your needs
-    int sensorNumber = ESP.getChipId();
-    JsonDocument doc;
-
-    doc["name"] = "Env " + String(sensorNumber) + " Pm10p0";
-    doc["stat_t"]   = _stateTopic;
-    doc["unit_of_meas"]   = "μg/mᵌ";
-    doc["sug_dsp_prc"] = 2; //         'suggested_display_precision',
-    doc["frc_upd"] = true;
-    doc["val_tpl"] = "{{ value_json.pm10p0|default(0) }}";
-
-    doc["uniq_id"] = String(ESP.getChipId()) + "_pm10p0";;
-    doc["device"] = _devDoc;
-
-    return doc;
-}
-
-String HaDiscovery::getDiscoveryTopicTemperature() {
-    int sensorNumber = ESP.getChipId();
-    return "homeassistant/sensor/env_sensor_" + String(sensorNumber) + "/temperature/config";
-}
-
-JsonDocument HaDiscovery::getMQTTTemperatureDiscoveryMsg() {
-    // My numeric sensor ID, you can change this to whatever suits your needs
-    int sensorNumber = ESP.getChipId();
-    JsonDocument doc;
-
-    doc["name"] = "Env " + String(sensorNumber) + " Temperature";
-    doc["stat_t"]   = _stateTopic;
-    doc["unit_of_meas"]   = "⁰C";
-    doc["sug_dsp_prc"] = 2; //         'suggested_display_precision',
-    doc["frc_upd"] = true;
-    doc["val_tpl"] = "{{ value_json.temperature|default(0) }}";
-
-    doc["uniq_id"] = String(ESP.getChipId()) + "_temp";;
-    doc["device"] = _devDoc;
-
-    return doc;
-}
-
-String HaDiscovery::getDiscoveryTopicHumidity() {
-    int sensorNumber = ESP.getChipId();
-    return "homeassistant/sensor/env_sensor_" + String(sensorNumber) + "/humidity/config";
-}
-
-JsonDocument HaDiscovery::getMQTTHumidityDiscoveryMsg() {
-    // My numeric sensor ID, you can change this to whatever suits your needs
-    int sensorNumber = ESP.getChipId();
-    JsonDocument doc;
-
-    doc["name"] = "Env " + String(sensorNumber) + " Humidity";
-    doc["stat_t"]   = _stateTopic;
-    doc["unit_of_meas"]   = "%RH";
-    doc["sug_dsp_prc"] = 2; //         'suggested_display_precision',
-    doc["frc_upd"] = true;
-    doc["val_tpl"] = "{{ value_json.humidity|default(0) }}";
-
-    doc["uniq_id"] = String(ESP.getChipId()) + "_humid";
-    doc["device"] = _devDoc;
-
-    return doc;
-}
-
-String HaDiscovery::getDiscoveryTopicVocindex() {
-    int sensorNumber = ESP.getChipId();
-    return "homeassistant/sensor/env_sensor_" + String(sensorNumber) + "/vocindex/config";
-}
-
-JsonDocument HaDiscovery::getMQTTVocIndexDiscoveryMsg() {
-    // My numeric sensor ID, you can change this to whatever suits your needs
-    int sensorNumber = ESP.getChipId();
-    JsonDocument doc;
-
-    doc["name"] = "Env " + String(sensorNumber) + " VocIndex";
-    doc["stat_t"]   = _stateTopic;
-    doc["unit_of_meas"]   = "";
-    // doc["sug_dsp_prc"] = 2; //         'suggested_display_precision',
-    doc["frc_upd"] = true;
-    doc["val_tpl"] = "{{ value_json.vocIndex|default(0) }}";
-
-    doc["uniq_id"] = String(ESP.getChipId()) + "_voci";
-    doc["device"] = _devDoc;
-
-    return doc;
-}
-
-String HaDiscovery::getDiscoveryTopicNoxindex() {
-    int sensorNumber = ESP.getChipId();
-    return "homeassistant/sensor/env_sensor_" + String(sensorNumber) + "/noxindex/config";
+void HaDiscovery::setDeviceInfo(const char* serialNumber, const char* hw_version, const char* sw_version) {
+    char ids[64];
+    char hw[16];
+    char sw[16];
+
+    // Sensors whose serial number could not be read stay apart.
+    copyJsonEscaped(ids, sizeof(ids), serialNumber[0] ? serialNumber : _nodeId);
+    copyJsonEscaped(hw, sizeof(hw), hw_version);
+    copyJsonEscaped(sw, sizeof(sw), sw_version);
+    // ids: identifiers, mf: manufacturer, mdl: model
+    snprintf(_device, sizeof(_device),
+             "{\"ids\":\"%s\",\"mf\":\"Sham(Sensirion)\",\"mdl\":\"SEN55\","
+             "\"name\":\"Sensirion SEN55\",\"hw\":\"%s\",\"sw\":\"%s\"}",
+             ids, hw, sw);
+}
+
+size_t HaDiscovery::count() const {
+    return SENSOR_DESCRIPTOR_COUNT;
+}
+
+size_t HaDiscovery::getDiscoveryTopic(size_t index, char* buf, size_t size) const {
+    if (index >= count()) {
+        return 0;
+    }
+    int n = snprintf(buf, size, "homeassistant/sensor/env_sensor_%s/%s/config",
+                     _nodeId, SENSOR_DESCRIPTORS[index].topic);
+    return n > 0 && (size_t) n < size ? n : 0;
+}
+
+size_t HaDiscovery::getDiscoveryMsg(size_t index, char* buf, size_t size) const {
+    if (index >= count()) {
+        return 0;
+    }
+    const SensorDescriptor& sensor = SENSOR_DESCRIPTORS[index];
+    char precision[24] = "";
+
+    if (sensor.precision >= 0) {
+        // 'suggested_display_precision'
+        snprintf(precision, sizeof(precision), "\"sug_dsp_prc\":%d,", sensor.precision);
+    }
+
+    int n = snprintf(buf, size,
+                     "{\"name\":\"Env %s %s\",\"stat_t\":\"%s\",\"unit_of_meas\":\"%s\",%s"
+                     "\"frc_upd\":true,\"val_tpl\":\"{{ value_json.%s|default(0) }}\","
+                     "\"uniq_id\":\"%s_%s\",\"device\":%s}",
+                     _nodeId, sensor.name, _stateTopic, sensor.unit, precision,
+                     sensor.key, _nodeId, sensor.uniqueIdSuffix, _device);
+    return n > 0 && (size_t) n < size ? n : 0;
+}
+
+uint32_t HaDiscovery::getConfigHash(char* buf, size_t size, uint32_t hash) const {
+    hash = fnv1a(hash, FIRMWARE_VERSION, strlen(FIRMWARE_VERSION));
+    for (size_t i = 0; i < count(); i++) {
+        hash = fnv1a(hash, buf, getDiscoveryTopic(i, buf, size));
+        hash = fnv1a(hash, buf, getDiscoveryMsg(i, buf, size));
+    }
+    return hash;
 }
-
-JsonDocument HaDiscovery::getMQTTNoxIndexDiscoveryMsg() {
-    // My numeric sensor ID, you can change this to whatever suits your needs
-    int sensorNumber = ESP.getChipId();
-    JsonDocument doc;
-
-    doc["name"] = "Env " + String(sensorNumber) + " NoxIndex";
-    doc["stat_t"]   = _stateTopic;
-    doc["unit_of_meas"]   = "";
-    // doc["sug_dsp_prc"] = 2; //         'suggested_display_precision',
-    doc["frc_upd"] = true;
-    doc["val_tpl"] = "{{ value_json.noxIndex|default(0) }}";
-
-    doc["uniq_id"] = String(ESP.getChipId()) + "_noxi";;
-    doc["device"] = _devDoc;
-
-    return doc;
-}
\ No newline at end of file
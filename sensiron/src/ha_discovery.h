@@ -1,39 +1,44 @@
 #ifndef HA_DISCOVERY_H
 #define HA_DISCOVERY_H
-#include <Arduino.h>
-#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
 
+#include "sensor_fields.h"
 
+// Part of the discovery config hash, bump it to make devices resend their
+// discovery messages after an update.
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION "1.1.0"
+#endif
+
+// Start value of getConfigHash().
+#define HA_DISCOVERY_HASH_INIT 2166136261UL
+
+// Generates the home assistant discovery topics and config messages for the
+// entries of SENSOR_DESCRIPTORS. The chip id and the device block are
+// formatted once, messages are written into a buffer given by the caller.
+// Every sensor of a node is a device of its own, sensor 0 keeps the ids of
+// a single sensor node.
 class HaDiscovery {
 public:
-	HaDiscovery(String stateTopic);
-    JsonDocument getMQTTPm1p0DiscoveryMsg();
-    JsonDocument getMQTTPm2p5DiscoveryMsg();
-    JsonDocument getMQTTPm4p0DiscoveryMsg();
-    JsonDocument getMQTTPm10p0DiscoveryMsg();
-    JsonDocument getMQTTTemperatureDiscoveryMsg();
-    JsonDocument getMQTTHumidityDiscoveryMsg();
-    JsonDocument getMQTTVocIndexDiscoveryMsg();
-    JsonDocument getMQTTNoxIndexDiscoveryMsg();
-
-    String getDiscoveryTopicPm1p0();
-    String getDiscoveryTopicPm2p5();
-    String getDiscoveryTopicPm4p0();
-    String getDiscoveryTopicPm10p0();
-    String getDiscoveryTopicTemperature();
-    String getDiscoveryTopicHumidity();
-    String getDiscoveryTopicVocindex();
-    String getDiscoveryTopicNoxindex();	
-
-    void setDeviceInfo(String serialNumber, String hw_version, String sw_version);
+	HaDiscovery(const char* stateTopic, uint32_t chipId, uint8_t sensor = 0);
+
+    size_t count() const;
+    // Both return the length written, 0 if it does not fit in buf.
+    size_t getDiscoveryTopic(size_t index, char* buf, size_t size) const;
+    size_t getDiscoveryMsg(size_t index, char* buf, size_t size) const;
+    // Hash of all topics and messages and the firmware version, used to only
+    // publish discovery when something changed. buf is scratch space. The
+    // hashes of several sensors are combined by passing the previous one.
+    uint32_t getConfigHash(char* buf, size_t size, uint32_t hash = HA_DISCOVERY_HASH_INIT) const;
+
+    void setDeviceInfo(const char* serialNumber, const char* hw_version, const char* sw_version);
 private:
 
-	String  _stateTopic;
-    JsonDocument _devDoc;
+	char _stateTopic[128];
+    // The chip id, followed by _<sensor> for sensors other than 0.
+    char _nodeId[16];
+    char _device[192];
 
 };
 #endif
-
-
-
-
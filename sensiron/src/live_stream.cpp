@@ -0,0 +1,81 @@
+#include "bench.h"
+#include "live_stream.h"
+#include "log.h"
+#include "metrics.h"
+#include "state_payload.h"
+
+LiveStream::LiveStream(const char* url) : _socket(url), _count(0) {}
+
+void LiveStream::begin(AsyncWebServer& server) {
+    _socket.onEvent([this](AsyncWebSocket* socket, AsyncWebSocketClient* client, AwsEventType type, void* arg,
+                           uint8_t* data, size_t length) {
+        (void) socket;
+        (void) arg;
+        (void) data;
+        (void) length;
+        onEvent(client, type);
+    });
+    server.addHandler(&_socket);
+}
+
+// Messages from the clients are ignored, disconnected clients are noticed by
+// updateClients().
+void LiveStream::onEvent(AsyncWebSocketClient* client, AwsEventType type) {
+    if (type != WS_EVT_CONNECT) {
+        return;
+    }
+    if (_socket.count() > LIVE_STREAM_MAX_CLIENTS || !_connected.push(client->id())) {
+        metrics.liveClientsDropped++;
+        client->close();
+        LOG_WARN("Live stream client limit reached, client %u rejected", (unsigned) client->id());
+    }
+}
+
+// Takes in the new clients, forgets the gone ones and disconnects those that
+// fell behind.
+void LiveStream::updateClients() {
+    uint32_t id;
+
+    while (_connected.pop(id)) {
+        if (_count < LIVE_STREAM_MAX_CLIENTS) {
+            _clients[_count++] = id;
+        } else if (AsyncWebSocketClient* client = _socket.client(id)) {
+            metrics.liveClientsDropped++;
+            client->close();
+        }
+    }
+    for (size_t i = 0; i < _count;) {
+        AsyncWebSocketClient* client = _socket.client(_clients[i]);
+        if (client && client->status() == WS_CONNECTED && client->queueIsFull()) {
+            LOG_WARN("Live stream client %u does not keep up, disconnected", (unsigned) _clients[i]);
+            metrics.liveClientsDropped++;
+            client->close();
+            client = nullptr;
+        }
+        if (client) {
+            i++;
+        } else {
+            _clients[i] = _clients[--_count];
+        }
+    }
+}
+
+void LiveStream::publish(uint8_t sensor, const SensirionMeasurement& data) {
+    BENCH_SCOPE("livePublish");
+    char frame[LIVE_STREAM_FRAME_SIZE];
+
+    updateClients();
+    if (_count == 0) {
+        return;
+    }
+    // The sample document is written over the separator after the sensor
+    // field, its opening brace is then replaced by the separator.
+    int prefix = snprintf(frame, sizeof(frame), "{\"sensor\":%u,", sensor);
+    size_t length = formatMeasurement(frame + prefix - 1, sizeof(frame) - prefix + 1, data);
+    if (length == 0) {
+        return;
+    }
+    frame[prefix - 1] = ',';
+    _socket.textAll(frame, prefix - 1 + length);
+    metrics.liveFrames++;
+}
@@ -0,0 +1,39 @@
+#ifndef LIVE_STREAM_H
+#define LIVE_STREAM_H
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "measurement.h"
+#include "spsc_queue.h"
+
+#ifndef LIVE_STREAM_MAX_CLIENTS
+#define LIVE_STREAM_MAX_CLIENTS 4
+#endif
+// A sample document with the sensor index.
+#define LIVE_STREAM_FRAME_SIZE 192
+
+// Pushes every sample to the clients connected on a WebSocket, so dashboards
+// get it when it is read instead of polling /data. A frame is formatted once
+// and its buffer shared by all clients. At most LIVE_STREAM_MAX_CLIENTS are
+// accepted, and a client whose send queue is full because it does not keep
+// up is disconnected instead of buffered for.
+class LiveStream {
+public:
+    LiveStream(const char* url);
+
+    void begin(AsyncWebServer& server);
+    // Sends the sample to every client, call from loop().
+    void publish(uint8_t sensor, const SensirionMeasurement& data);
+
+private:
+    void onEvent(AsyncWebSocketClient* client, AwsEventType type);
+    void updateClients();
+
+    AsyncWebSocket _socket;
+    // Connected clients handed from the event handler, which runs in the
+    // TCP stack, to publish().
+    SpscQueue<uint32_t, 8> _connected;
+    uint32_t _clients[LIVE_STREAM_MAX_CLIENTS];
+    size_t _count;
+};
+#endif
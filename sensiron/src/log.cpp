@@ -0,0 +1,24 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include "log.h"
+
+void logPrintf(char level, const char* format, ...) {
+    char line[LOG_LINE_SIZE];
+    va_list args;
+
+    va_start(args, format);
+#ifdef ARDUINO
+    vsnprintf_P(line, sizeof(line), format, args);
+#else
+    vsnprintf(line, sizeof(line), format, args);
+#endif
+    va_end(args);
+
+#ifdef ARDUINO
+    Serial.print(level);
+    Serial.print(' ');
+    Serial.println(line);
+#else
+    fprintf(stderr, "%c %s\n", level, line);
+#endif
+}
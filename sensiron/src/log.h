@@ -0,0 +1,54 @@
+#ifndef LOG_H
+#define LOG_H
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+// Host builds keep the format strings in RAM and log to stderr.
+#define PSTR(s) (s)
+#endif
+
+// Serial logging with a compile time level. Statements above LOG_LEVEL
+// compile to nothing, their arguments are not evaluated and their format
+// strings are not linked in. Format strings are kept in flash.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Longest line that is written, longer ones are truncated.
+#ifndef LOG_LINE_SIZE
+#define LOG_LINE_SIZE 256
+#endif
+
+void logPrintf(char level, const char* format, ...);
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) logPrintf('E', PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) logPrintf('W', PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) logPrintf('I', PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) logPrintf('D', PSTR(format), ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) do {} while (0)
+#endif
+
+#endif
@@ -10,25 +10,209 @@
 
 #include <Preferences.h>
 
-#include "ha_discovery.h"
+#include "arduino_io.h"
+#include "bench.h"
+#include "config_page.h"
+#include "live_stream.h"
+#include "log.h"
+#include "metrics.h"
+#include "platform_compat.h"
+#include "sample_history.h"
 #include "sensirion.h"
-
+#include "sensor_command.h"
+#include "sensor_fields.h"
+#include "sensor_pipeline.h"
+#include "settings_store.h"
+// On the dual core ESP32 the sensor is read and the publish windows are
+// aggregated by a task of their own, see samplingTask().
+#if defined(ESP32) && !CONFIG_FREERTOS_UNICORE
+#define SAMPLING_TASK
+#include "spsc_queue.h"
+#endif
+
+// Power saving: the radio sleeps and wakes for every DTIM listen interval
+// beacons, the loop sleeps in delay() until the next sensor poll or publish.
+// Sleep at most POWER_MAX_IDLE_MS at a time so the replay and mqtt loop keep
+// running.
+#ifndef POWER_LISTEN_INTERVAL
+#define POWER_LISTEN_INTERVAL 3
+#endif
+#ifndef POWER_MAX_IDLE_MS
+#define POWER_MAX_IDLE_MS 1000
+#endif
+// MQTT keepalive in seconds while the radio is awake and while it sleeps.
+// Every publish window already keeps the session alive, a longer keepalive
+// saves the radio wakeups for pings.
+#ifndef MQTT_KEEPALIVE_S
+#define MQTT_KEEPALIVE_S 15
+#endif
+#ifndef MQTT_SLEEP_KEEPALIVE_S
+#define MQTT_SLEEP_KEEPALIVE_S 60
+#endif
+
+// The VOC algorithm state is saved at most this often and only when it
+// changed, about 9000 small flash writes a year. A restart within the first
+// interval keeps the state of the previous run.
+#ifndef VOC_STATE_SAVE_INTERVAL_MS
+#define VOC_STATE_SAVE_INTERVAL_MS 3600000
+#endif
+
+// The sampling task runs on SAMPLING_TASK_CORE above the priority of the
+// network side, loop() and the WiFi stack run on the other core. Closed
+// windows wait in a queue of WINDOW_QUEUE_CAPACITY (a power of two, room for
+// two windows of every sensor) until loop() publishes them.
+#ifndef SAMPLING_TASK_CORE
+#define SAMPLING_TASK_CORE 1
+#endif
+#ifndef SAMPLING_TASK_PRIORITY
+#define SAMPLING_TASK_PRIORITY 5
+#endif
+#ifndef SAMPLING_TASK_STACK
+#define SAMPLING_TASK_STACK 4096
+#endif
+#ifndef WINDOW_QUEUE_CAPACITY
+#define WINDOW_QUEUE_CAPACITY 16
+#endif
+// Samples waiting for loop() to push them to the live stream.
+#ifndef LIVE_QUEUE_CAPACITY
+#define LIVE_QUEUE_CAPACITY 8
+#endif
+
+// Number of SEN5x sensors, up to 8. With more than one, sensor n sits on
+// channel n of a TCA9548A mux and publishes on <stateTopic>/<n>, sensor 0
+// keeps the state topic itself and is the one served on /data.
+#ifndef SEN5X_SENSOR_COUNT
+#define SEN5X_SENSOR_COUNT 1
+#endif
+
+enum class PowerMode : uint8_t {
+    AlwaysOn,
+    ModemSleep,
+    LightSleep
+};
+
+// A publish window as handed from the sampling task to loop().
+struct ClosedWindow {
+    unsigned long closedAt; // millis()
+    uint8_t sensor;
+    MeasurementAggregator window;
+};
+
+// NVS on the ESP32 limits namespaces to 15 characters.
+#ifdef ESP32
+const char* PREFS_NAMESPACE = "SensirionSensor";
+#else
+const char* PREFS_NAMESPACE = "Sensirion Sensor";
+#endif
 Preferences prefs;
+// Configuration, changes are written to prefs from loop() in one batch.
+SettingsStore settingsStore(prefs);
 
 AsyncWebServer server(80);
 DNSServer dns;
 
-JsonDocument sensordata;
-
 WiFiClient wifiClient;
 PubSubClient mqttClient(wifiClient);
-
-// This is the topic this program will send the state of this device to.
-String stateTopic;
-String mqttServerIp;
-int mqttServerPort;
-boolean mqttEnabled;
-
+PubSubMqttClient pipelineClient(mqttClient);
+ArduinoClock pipelineClock;
+
+static_assert(SEN5X_SENSOR_COUNT >= 1 && SEN5X_SENSOR_COUNT <= SamplingScheduler::MAX_SENSORS,
+              "SEN5X_SENSOR_COUNT must be 1 to 8");
+I2cMux i2cMux(Wire);
+Sen5xSensor sensors[SEN5X_SENSOR_COUNT];
+SensorChannel channels[SEN5X_SENSOR_COUNT];
+// Every sample as it is read, on ws://<device>/ws.
+LiveStream liveStream("/ws");
+// Samples and rollups of the first sensor served on /history. Written by
+// the sampling side only, readers do not lock it.
+SampleHistory history;
+#ifdef SAMPLING_TASK
+SpscQueue<ClosedWindow, WINDOW_QUEUE_CAPACITY> windowQueue;
+SpscQueue<TimedMeasurement, LIVE_QUEUE_CAPACITY> liveQueue;
+// Held for every transaction with the sensor, the MQTT command handler
+// reconfigures it from the network side.
+SemaphoreHandle_t sensorMutex;
+#endif
+#ifdef ESP32
+// Held while the web handlers, which run in the AsyncTCP task, and loop()
+// exchange settings.
+SemaphoreHandle_t settingsMutex;
+#endif
+
+// Hands the samples and the closed windows of the sampling side on.
+class FirmwareListener : public SampleListener {
+public:
+    void sampleRead(size_t sensor, unsigned long now, const SensirionMeasurement& data) override;
+    void windowClosed(size_t sensor, unsigned long now, const MeasurementAggregator& window) override;
+};
+FirmwareListener listener;
+
+// Sampling, aggregation, store and forward and the MQTT connection, the same
+// code the native simulation runs. /data serves its state cache.
+SensorPipeline pipeline(pipelineClock, pipelineClient, channels, SEN5X_SENSOR_COUNT, listener);
+// Hash of the discovery config as stored in prefs.
+uint32_t storedDiscoveryHash = 0;
+
+PowerMode powerMode = PowerMode::AlwaysOn;
+Sen5xTuning sen5xTuning;
+// Set by loop(), the sensors are reconfigured by the sampling side between
+// reads.
+volatile bool tuningChanged = false;
+// The settings in use as the web handlers show them, and the settings
+// submitted on /get until loop() takes them into use. Guarded by
+// SettingsLock.
+Settings shownSettings;
+Settings pendingSettings;
+bool settingsPending = false;
+
+// The VOC algorithm state read from a sensor, saved to prefs by loop().
+struct VocStateSample {
+    uint8_t sensor;
+    uint8_t state[SEN5X_VOC_STATE_SIZE];
+};
+#ifdef SAMPLING_TASK
+SpscQueue<VocStateSample, 2> vocStateQueue;
+#endif
+
+
+// Observes the lifetime of the timer in a latency histogram.
+class LatencyTimer {
+public:
+    LatencyTimer(LatencyHistogram& histogram) : _histogram(histogram), _start(micros()) {}
+    ~LatencyTimer() { _histogram.observe(micros() - _start); }
+
+private:
+    LatencyHistogram& _histogram;
+    uint32_t _start;
+};
+
+// Exclusive access to the sensor for its lifetime, only needed when the
+// sampling task shares it.
+class SensorLock {
+public:
+#ifdef SAMPLING_TASK
+    SensorLock() { xSemaphoreTake(sensorMutex, portMAX_DELAY); }
+    ~SensorLock() { xSemaphoreGive(sensorMutex); }
+#else
+    SensorLock() {}
+#endif
+};
+
+// Exclusive access to shownSettings and pendingSettings for its lifetime.
+class SettingsLock {
+public:
+#ifdef ESP32
+    SettingsLock() { xSemaphoreTake(settingsMutex, portMAX_DELAY); }
+    ~SettingsLock() { xSemaphoreGive(settingsMutex); }
+#else
+    SettingsLock() {}
+#endif
+};
+
+// Counts and times a web request for the handler scope.
+#define HTTP_HANDLER_METRICS() \
+    metrics.httpRequests++; \
+    LatencyTimer handlerTimer(metrics.httpHandler)
 
 void notFound(AsyncWebServerRequest *request) {
     request->send(404, "text/plain", "Not found");
@@ -38,94 +222,399 @@ const char* TOPIC_MESSAGE = "Mqtt topic";
 const char* SERVER_IP_MESSAGE = "Mqtt Server";
 const char* SERVER_PORT_MESSAGE = "Mqtt port";
 const char* MQTT_ENABLED_MESSAGE = "mqtt_enabled";
+const char* PUBLISH_INTERVAL_MESSAGE = "Publish interval";
+const char* HEARTBEAT_MESSAGE = "Heartbeat";
+const char* BATCH_SIZE_MESSAGE = "Batch size";
+const char* BATCH_ENCODING_MESSAGE = "Batch encoding";
+const char* POWER_MODE_MESSAGE = "Power mode";
+const char* WARM_START_MESSAGE = "Warm start";
+const char* RHT_ACCELERATION_MESSAGE = "RHT acceleration";
+// Labels of the RHT acceleration modes, indexed by mode.
+const char* RHT_ACCELERATION_LABELS[] = {"Low", "High", "Medium"};
+// Form values of the power modes, indexed by PowerMode.
+const char* POWER_MODE_NAMES[] = {"on", "modem", "light"};
+const char* POWER_MODE_LABELS[] = {"Radio always on", "Modem sleep", "Light sleep"};
+// Per field deadband parameters are these prefixes followed by the field key.
+const char* DEADBAND_PREFIX = "db_";
+const char* DEADBAND_RELATIVE_PREFIX = "dbr_";
+
+// The port number in text, 0 unless it is a number from 1 to 65535.
+static uint16_t parsePort(const char* text) {
+    char* end;
+
+    if (!isdigit((unsigned char) text[0])) {
+        return 0;
+    }
+    unsigned long port = strtoul(text, &end, 10);
+    return *end == '\0' && port <= 65535 ? (uint16_t) port : 0;
+}
+
+// True if the placeholder name of the given length is key.
+static bool isPlaceholder(const char* name, size_t length, const char* key) {
+    return strlen(key) == length && strncmp(name, key, length) == 0;
+}
 
-String genHtml(String stateTopic, String mqttServerIp, String mqttServerPort, bool mqttEnabled) {
-    String html;
-    html += R"(<!DOCTYPE HTML><html><head>)";
-    html += R"(<title>Environmental Sensor</title>)";
-    html += R"(<meta name="viewport" content="width=device-width, initial-scale=1">)";
-    html += R"(</head><body>)";
-    html += R"(<form action="/get">)";
-    html += R"(<input type="text" name="Mqtt topic" value=")" + stateTopic + R"(">)";
-    html += R"(<label for="Mqtt topic"> MQTT Topic</label><br>)";
-    html += R"(<input type="text" name="Mqtt Server" value=")" + mqttServerIp + R"(">)";
-    html += R"(<label for="Mqtt Server"> MQTT Server IP</label><br>)";
-    html += R"(<input type="text" name="Mqtt port" value=")" + mqttServerPort + R"(">)";
-    html += R"(<label for="Mqtt port"> MQTT Server Port</label><br>)";
-    // html += R"(<input type='hidden' value='No' name='mqtt_enabled'>)"; //Hiden value to send No if the checkbox is not sent.
-    if (mqttEnabled) {
-        html += R"(<input type="checkbox" name="mqtt_enabled" value="Yes" checked>)";
+// What a settings page shows, the response keeps a copy.
+struct ConfigPageContent {
+    Settings settings;
+    // Why the submitted settings were rejected, empty if they were not.
+    char error[64];
+};
+
+// Expands the placeholders of CONFIG_PAGE from the ConfigPageContent in
+// context.
+void expandConfigPage(void* context, const char* name, size_t length, ChunkWriter& out) {
+    const ConfigPageContent& content = *(const ConfigPageContent*) context;
+    const Settings& settings = content.settings;
+
+    if (isPlaceholder(name, length, "ERROR")) {
+        if (content.error[0]) {
+            out.print("<p><b>Settings not saved: ");
+            out.printEscaped(content.error);
+            out.print("</b></p>");
+        }
+    } else if (isPlaceholder(name, length, "TOPIC")) {
+        out.printEscaped(settings.stateTopic);
+    } else if (isPlaceholder(name, length, "SERVER")) {
+        out.printEscaped(settings.mqttServer);
+    } else if (isPlaceholder(name, length, "PORT")) {
+        out.printf("%u", settings.mqttPort);
+    } else if (isPlaceholder(name, length, "MQTT_CHECKED")) {
+        out.print(settings.mqttEnabled ? " checked" : "");
+    } else if (isPlaceholder(name, length, "MQTT_ENABLED")) {
+        out.print(settings.mqttEnabled ? "Yes" : "No");
+    } else if (isPlaceholder(name, length, "PUBLISH_INTERVAL")) {
+        out.printf("%u", settings.publishInterval);
+    } else if (isPlaceholder(name, length, "HEARTBEAT")) {
+        out.printf("%lu", (unsigned long) settings.heartbeat);
+    } else if (isPlaceholder(name, length, "DEADBANDS")) {
+        for (const SensorDescriptor& sensor : SENSOR_DESCRIPTORS) {
+            out.printf(R"(<input type="number" step="any" min="0" name="%s%s" value="%g">)",
+                       DEADBAND_PREFIX, sensor.key, (double) settings.deadbandThreshold[(size_t) sensor.field]);
+            out.printf(R"(<input type="checkbox" name="%s%s" value="Yes"%s>)", DEADBAND_RELATIVE_PREFIX,
+                       sensor.key, settings.deadbandRelative[(size_t) sensor.field] ? " checked" : "");
+            out.printf(R"(<label for="%s%s"> %s deadband (checked: %%)</label><br>)",
+                       DEADBAND_PREFIX, sensor.key, sensor.name);
+        }
+    } else if (isPlaceholder(name, length, "BATCH_MAX")) {
+        out.printf("%d", SAMPLE_BATCH_CAPACITY);
+    } else if (isPlaceholder(name, length, "BATCH_SIZE")) {
+        out.printf("%u", settings.batchSize);
+    } else if (isPlaceholder(name, length, "BATCH_ENCODINGS")) {
+        for (BatchEncoding encoding : {BatchEncoding::Json, BatchEncoding::MessagePack, BatchEncoding::Binary}) {
+            const char* encodingName = batchEncodingName(encoding);
+            out.printf(R"(<option value="%s"%s>%s</option>)", encodingName,
+                       (uint8_t) encoding == settings.batchEncoding ? " selected" : "", encodingName);
+        }
+    } else if (isPlaceholder(name, length, "POWER_MODES")) {
+        for (size_t i = 0; i < sizeof(POWER_MODE_NAMES) / sizeof(POWER_MODE_NAMES[0]); i++) {
+            out.printf(R"(<option value="%s"%s>%s</option>)", POWER_MODE_NAMES[i],
+                       settings.powerMode == i ? " selected" : "", POWER_MODE_LABELS[i]);
+        }
+    } else if (isPlaceholder(name, length, "WARM_START")) {
+        out.printf("%u", settings.warmStart);
+    } else if (isPlaceholder(name, length, "RHT_ACCELERATIONS")) {
+        for (size_t i = 0; i < sizeof(RHT_ACCELERATION_LABELS) / sizeof(RHT_ACCELERATION_LABELS[0]); i++) {
+            out.printf(R"(<option value="%u"%s>%s</option>)", (unsigned) i,
+                       settings.rhtAcceleration == i ? " selected" : "", RHT_ACCELERATION_LABELS[i]);
+        }
+    }
+}
+
+// Streams the settings page in chunks straight into the TCP send buffer, the
+// heap used does not grow with the page. The response keeps its own copy of
+// the settings, every chunk is rendered from the same values, and continues
+// the template where the previous chunk stopped.
+void sendConfigPage(AsyncWebServerRequest* request, const Settings& settings, const char* error = "") {
+    ConfigPageContent content;
+
+    content.settings = settings;
+    snprintf(content.error, sizeof(content.error), "%s", error);
+    request->send(request->beginChunkedResponse("text/html",
+            [snapshot = content, cursor = TemplateCursor()](uint8_t* buffer, size_t maxLen,
+                                                             size_t index) mutable -> size_t {
+        BENCH_SCOPE("configPage");
+        (void) index; // Chunks are requested in order.
+        ChunkWriter out(buffer, maxLen);
+        renderTemplate(CONFIG_PAGE, cursor, out, expandConfigPage, &snapshot);
+        return out.length();
+    }));
+}
+
+
+void applyPowerMode() {
+#ifdef ESP32
+    // The Arduino core has no automatic light sleep, it falls back to modem
+    // sleep with the listen interval of the access point.
+    WiFi.setSleep(powerMode == PowerMode::AlwaysOn ? WIFI_PS_NONE : WIFI_PS_MAX_MODEM);
+#else
+    switch (powerMode) {
+    case PowerMode::AlwaysOn:
+        WiFi.setSleepMode(WIFI_NONE_SLEEP);
+        break;
+    case PowerMode::ModemSleep:
+        WiFi.setSleepMode(WIFI_MODEM_SLEEP, POWER_LISTEN_INTERVAL);
+        break;
+    case PowerMode::LightSleep:
+        WiFi.setSleepMode(WIFI_LIGHT_SLEEP, POWER_LISTEN_INTERVAL);
+        break;
+    }
+#endif
+    // Sent in the CONNECT packet, applies from the next connection.
+    mqttClient.setKeepAlive(powerMode == PowerMode::AlwaysOn ? MQTT_KEEPALIVE_S : MQTT_SLEEP_KEEPALIVE_S);
+}
+
+// Preference key of the VOC algorithm state of sensor, "vocState" for the
+// first one.
+void vocStateKey(size_t sensor, char* key, size_t size) {
+    if (sensor == 0) {
+        snprintf(key, size, "vocState");
     } else {
-        html += R"(<input type="checkbox" name="mqtt_enabled" value="Yes">)";
-    }
-    html += R"(<label for="mqtt_enabled"> MQTT Enabled</label><br><br>)";
-    html += R"(<input type="submit" value="Submit">)";
-    html += R"(</form><br>)";
-    html += "<h1 class=\"label\">MQTT Config</h1>";
-    html += "MQTT Topic: " + stateTopic + "<br>";
-    html += "MQTT Server: " + mqttServerIp + "<br>";
-    html += "MQTT Port: " + mqttServerPort + "<br>";
-    String enabled = mqttEnabled ? "Yes" : "No";
-    html += "MQTT Enabled: " + enabled + "<br>";
-    html += R"(<p><a href="/data">Json sensor data</a></p><br>)";
-    html += "</body></html>";
-
-    return html;
-}
-
-
-void publishMQTT(JsonDocument doc, String topic_dev) {
-    // Serialize the JSON document to a char buffer
-    char jsonBuffer[512];
-    size_t n = serializeJson(doc, jsonBuffer);
-    const char* payload = jsonBuffer;
-    mqttClient.publish(topic_dev.c_str(), jsonBuffer, n);
-    Serial.println("Published message: "+ topic_dev + String(payload));
-}
-
-void sendMQTT(SensirionMeasurement data) {
-    JsonDocument doc;
-  
-    // Send the sensirion data, to environment/sensirion/technical/
-    // String topic_dev = "environment/sensirion/garage";
-
-    doc["pm1p0"] = data.massConcentrationPm1p0;
-    doc["pm2p5"] = data.massConcentrationPm2p5;
-    doc["pm4p0"] = data.massConcentrationPm4p0;
-    doc["pm10p0"] = data.massConcentrationPm10p0;
-    doc["humidity"] = data.ambientHumidity;
-    doc["temperature"] = data.ambientTemperature;
-    doc["vocIndex"] = data.vocIndex;
-    doc["noxIndex"] = data.noxIndex;
-
-    publishMQTT(doc, stateTopic);
-    
-    sensordata = doc;
+        snprintf(key, size, "vocState%u", (unsigned) sensor);
+    }
+}
+
+// Saves the state unless it is the one saved last. Called from loop(), the
+// only place prefs are written after setup().
+void saveVocState(const VocStateSample& sample) {
+    static uint8_t saved[SEN5X_SENSOR_COUNT][SEN5X_VOC_STATE_SIZE];
+    char key[16];
+
+    vocStateKey(sample.sensor, key, sizeof(key));
+    if (memcmp(sample.state, saved[sample.sensor], sizeof(sample.state)) != 0 &&
+        prefs.putBytes(key, sample.state, sizeof(sample.state)) == sizeof(sample.state)) {
+        memcpy(saved[sample.sensor], sample.state, sizeof(sample.state));
+        LOG_DEBUG("VOC algorithm state of sensor %u saved", (unsigned) sample.sensor);
+    }
 }
 
-void reconnectMQTT() {
-    String mac_addr = WiFi.macAddress();
+// Reads the state of one sensor per call, the sensors take turns so every
+// one is saved once per interval. The sampling task hands the state to
+// loop() through the queue.
+void readVocState(unsigned long now) {
+    static unsigned long previousRead = 0;
+    static size_t sensor = 0;
+    VocStateSample sample;
 
-    if (!mqttClient.connected()) {
-        mqttClient.setServer(mqttServerIp.c_str(), mqttServerPort);
-        while (!mqttClient.connect(mac_addr.c_str())) {
-            Serial.println("MQTT Not Connected");
-            delay (1000);
+    if (now - previousRead < VOC_STATE_SAVE_INTERVAL_MS / SEN5X_SENSOR_COUNT) {
+        return;
+    }
+    previousRead = now;
+    sensor = (sensor + 1) % SEN5X_SENSOR_COUNT;
+    sample.sensor = (uint8_t) sensor;
+    if (!sensors[sensor].getVocState(sample.state)) {
+        return;
+    }
+#ifdef SAMPLING_TASK
+    vocStateQueue.push(sample);
+#else
+    saveVocState(sample);
+#endif
+}
+
+void FirmwareListener::sampleRead(size_t sensor, unsigned long now, const SensirionMeasurement& data) {
+    if (sensor == 0) {
+        history.add(now / 1000, data);
+    }
+#ifdef SAMPLING_TASK
+    TimedMeasurement sample = {(uint32_t) (now / 1000), (uint8_t) sensor, data};
+    liveQueue.push(sample);
+#else
+    liveStream.publish(sensor, data);
+#endif
+}
+
+void FirmwareListener::windowClosed(size_t sensor, unsigned long now, const MeasurementAggregator& window) {
+#ifdef SAMPLING_TASK
+    ClosedWindow closed = {now, (uint8_t) sensor, window};
+    if (!windowQueue.push(closed)) {
+        LOG_WARN("Window queue full, window dropped");
+    }
+#else
+    pipeline.publishWindow(sensor, window, now);
+#endif
+}
+
+// Reads the sensor whose turn it is and closes the publish windows. Runs in
+// loop(), or in the sampling task which hands the closed windows to loop()
+// through the queue.
+void sampleSensor(unsigned long now) {
+    SensorLock lock;
+
+    // The other commands go out between reads.
+    if (!pipeline.reading()) {
+        if (tuningChanged) {
+            tuningChanged = false;
+            for (Sen5xSensor& sensor : sensors) {
+                sensor.applyTuning(sen5xTuning);
+            }
         }
-        // Send discovery messages
-        HaDiscovery ha_discovery(stateTopic);
-        ha_discovery.setDeviceInfo(getSen5xSerialNumber(), getSen5xHwVersion(), getSen5xSwVersion());
-        publishMQTT(ha_discovery.getMQTTPm1p0DiscoveryMsg(), ha_discovery.getDiscoveryTopicPm1p0());
-        publishMQTT(ha_discovery.getMQTTPm2p5DiscoveryMsg(), ha_discovery.getDiscoveryTopicPm2p5());
-        publishMQTT(ha_discovery.getMQTTPm4p0DiscoveryMsg(), ha_discovery.getDiscoveryTopicPm4p0());
-        publishMQTT(ha_discovery.getMQTTPm10p0DiscoveryMsg(), ha_discovery.getDiscoveryTopicPm10p0());
-        publishMQTT(ha_discovery.getMQTTTemperatureDiscoveryMsg(), ha_discovery.getDiscoveryTopicTemperature());
-        publishMQTT(ha_discovery.getMQTTHumidityDiscoveryMsg(), ha_discovery.getDiscoveryTopicHumidity());
-        publishMQTT(ha_discovery.getMQTTVocIndexDiscoveryMsg(), ha_discovery.getDiscoveryTopicVocindex());
-        publishMQTT(ha_discovery.getMQTTNoxIndexDiscoveryMsg(), ha_discovery.getDiscoveryTopicNoxindex());
+        readVocState(now);
+    }
+    pipeline.sample(now);
+}
+
+// Milliseconds until sampleSensor() has something to do, capped to
+// POWER_MAX_IDLE_MS.
+unsigned long samplingIdleTime(unsigned long now) {
+    return min(pipeline.idleTime(now), (unsigned long) POWER_MAX_IDLE_MS);
+}
 
+#ifdef SAMPLING_TASK
+// Keeps the sampling on time whatever the network side is doing, it only
+// waits for the sensor lock while an MQTT command reconfigures the sensors.
+void samplingTask(void* parameter) {
+    (void) parameter;
+    for (;;) {
+        sampleSensor(millis());
+        unsigned long idle = samplingIdleTime(millis());
+        vTaskDelay(max(pdMS_TO_TICKS(idle), (TickType_t) 1));
+    }
+}
+
+// Publishes the windows closed by the sampling task.
+void publishClosedWindows() {
+    static ClosedWindow closed;
+
+    while (windowQueue.pop(closed)) {
+        pipeline.publishWindow(closed.sensor, closed.window, closed.closedAt);
+    }
+}
+
+// Pushes the samples read by the sampling task to the live stream.
+void publishLiveSamples() {
+    TimedMeasurement sample;
+
+    while (liveQueue.pop(sample)) {
+        liveStream.publish(sample.sensor, sample.data);
+    }
+}
+
+// Saves the VOC algorithm states read by the sampling task.
+void saveVocStates() {
+    VocStateSample sample;
+
+    while (vocStateQueue.pop(sample)) {
+        saveVocState(sample);
+    }
+}
+#endif
+
+// Takes the settings into the runtime state.
+void applySettings(const Settings& settings) {
+    pipeline.applySettings(settings);
+    powerMode = (PowerMode) constrain(settings.powerMode, 0, (int) PowerMode::LightSleep);
+    sen5xTuning.temperatureOffset = settings.temperatureOffset;
+    sen5xTuning.temperatureSlope = settings.temperatureSlope;
+    sen5xTuning.temperatureTimeConstant = settings.temperatureTimeConstant;
+    sen5xTuning.warmStart = settings.warmStart;
+    sen5xTuning.rhtAcceleration = settings.rhtAcceleration;
+    sen5xTuning.fanCleaningInterval = settings.fanCleaningInterval;
+}
+
+// The settings as currently in use, handed to the settings store.
+Settings captureSettings() {
+    Settings settings;
+
+    memset(&settings, 0, sizeof(settings));
+    pipeline.captureSettings(settings);
+    settings.powerMode = (uint8_t) powerMode;
+    settings.temperatureOffset = sen5xTuning.temperatureOffset;
+    settings.temperatureSlope = sen5xTuning.temperatureSlope;
+    settings.temperatureTimeConstant = sen5xTuning.temperatureTimeConstant;
+    settings.warmStart = sen5xTuning.warmStart;
+    settings.rhtAcceleration = sen5xTuning.rhtAcceleration;
+    settings.fanCleaningInterval = sen5xTuning.fanCleaningInterval;
+    return settings;
+}
+
+// Hands the settings now in use to the settings store and the web handlers,
+// called from loop() after every change.
+void settingsChanged(unsigned long now) {
+    Settings settings = captureSettings();
+
+    settingsStore.update(settings, now);
+    SettingsLock lock;
+    shownSettings = settings;
+}
+
+// The settings as the web handlers show them, including a submit that
+// loop() did not take yet.
+Settings webSettings() {
+    SettingsLock lock;
+    return settingsPending ? pendingSettings : shownSettings;
+}
+
+// Takes the settings submitted on /get into use.
+void applyPendingSettings(unsigned long now) {
+    Settings settings;
+    {
+        SettingsLock lock;
+        if (!settingsPending) {
+            return;
+        }
+        settings = pendingSettings;
+        settingsPending = false;
+    }
+
+    PowerMode previousPowerMode = powerMode;
+    Sen5xTuning previousTuning = sen5xTuning;
+    {
+        // The sampling side uses the schedule and the report filters.
+        SensorLock lock;
+        applySettings(settings);
+    }
+    if (sen5xTuning.warmStart != previousTuning.warmStart ||
+        sen5xTuning.rhtAcceleration != previousTuning.rhtAcceleration) {
+        tuningChanged = true;
+    }
+    if (powerMode != previousPowerMode) {
+        applyPowerMode();
+        // Reconnect so the new keepalive is used.
+        pipeline.connection().disconnect();
+    }
+    // Only written when something changed, from loop() after the commit delay.
+    settingsChanged(now);
+    pipeline.requestDiscovery(false); // The state topic is part of the discovery config.
+}
+
+// Handles a command on <stateTopic>/set, see sensor_command.h. The settings
+// are validated as a whole, applied to every sensor and only persisted when
+// all sensors took them. Runs from mqttClient.loop() in loop().
+void onMqttMessage(char* topic, uint8_t* payload, unsigned int length) {
+    char id[33] = "";
+    char error[64] = "";
+    char resultTopic[128];
+    Sen5xTuning tuning = sen5xTuning;
+
+    (void) topic; // Only the command topic is subscribed.
+    if (parseTuningCommand((const char*) payload, length, tuning, id, sizeof(id), error, sizeof(error))) {
+        SensorLock lock;
+        bool applied = true;
+        for (Sen5xSensor& sensor : sensors) {
+            applied = sensor.applyTuning(tuning) && applied;
+        }
+        if (applied) {
+            sen5xTuning = tuning;
+            settingsChanged(millis());
+        } else {
+            snprintf(error, sizeof(error), "sensor did not accept the settings");
+            for (Sen5xSensor& sensor : sensors) {
+                sensor.applyTuning(sen5xTuning);
+            }
+        }
+    }
+    if (error[0]) {
+        LOG_WARN("Command rejected: %s", error);
+    }
+
+    // The payload points into the client buffer, it is not used past here.
+    char* result = pipeline.publishBuffer();
+    size_t n = formatCommandResult(result, pipeline.publishBufferSize(), id, error[0] ? error : nullptr, sen5xTuning);
+    snprintf(resultTopic, sizeof(resultTopic), "%s/set/result", pipeline.stateTopic());
+    if (n) {
+        pipeline.publish(resultTopic, result, n);
     }
-    Serial.println("MQTT Connected");
 }
 
 void setup() {
@@ -135,7 +624,40 @@ void setup() {
         delay(100);
     }
 
-    sen5xSetup();
+#ifdef ESP32
+    settingsMutex = xSemaphoreCreateMutex();
+#endif
+    prefs.begin(PREFS_NAMESPACE);
+    settingsStore.begin();
+    applySettings(settingsStore.settings());
+    shownSettings = captureSettings();
+    storedDiscoveryHash = prefs.getUInt("discoveryHash", 0);
+    pipeline.setDiscoveryHash(storedDiscoveryHash);
+    i2cBegin(Wire);
+    for (size_t sensor = 0; sensor < SEN5X_SENSOR_COUNT; sensor++) {
+        channels[sensor].sensor = &sensors[sensor];
+        if (SEN5X_SENSOR_COUNT > 1) {
+            sensors[sensor].attach(Wire, &i2cMux, sensor);
+        }
+        // Restored before the measurement starts so the VOC index continues
+        // where it was instead of learning for hours.
+        uint8_t vocState[SEN5X_VOC_STATE_SIZE];
+        char key[16];
+        vocStateKey(sensor, key, sizeof(key));
+        bool haveVocState = prefs.getBytes(key, vocState, sizeof(vocState)) == sizeof(vocState);
+        sensors[sensor].begin(sen5xTuning, haveVocState ? vocState : nullptr);
+    }
+    // Started a fraction of the sample period apart, so the sensors have
+    // their data ready one after the other instead of all at once.
+    unsigned long started = millis();
+    for (size_t sensor = 0; sensor < SEN5X_SENSOR_COUNT; sensor++) {
+        unsigned long elapsed = millis() - started;
+        if (elapsed < pipeline.scheduler().startOffset(sensor)) {
+            delay(pipeline.scheduler().startOffset(sensor) - elapsed);
+        }
+        sensors[sensor].start();
+    }
+    pipeline.begin();
 
     // WiFi.mode(WIFI_STA); // explicitly set mode, esp defaults to STA+AP
     // it is a good practice to make sure your code sets wifi mode how you want it.
@@ -158,79 +680,263 @@ void setup() {
     //res = wm.autoConnect("SensirionAP","sens"); // password protected ap
 
     if(!res) {
-        Serial.println("Failed to connect");
+        LOG_ERROR("Failed to connect");
         // ESP.restart();
     } 
     else {
         //if you get here you have connected to the WiFi    
-        Serial.println("connected...yeey :)");
+        LOG_INFO("WiFi connected");
     }
 
-    mqttClient.setBufferSize(512);
+    // Room for the topic and a full state document with statistics or a batch.
+    mqttClient.setBufferSize(max(STATE_PAYLOAD_SIZE, SAMPLE_BATCH_PAYLOAD_SIZE) + 256);
+    // Bound the time a single connect attempt can block the loop, the ESP32
+    // core takes seconds instead of milliseconds.
+#ifdef ESP32
+    wifiClient.setTimeout(2);
+#else
+    wifiClient.setTimeout(2000);
+#endif
+    mqttClient.setSocketTimeout(2);
+    mqttClient.setCallback(onMqttMessage);
 
-    prefs.begin("Sensirion Sensor");
-    stateTopic = prefs.getString("mqttStateTopic", "environment/sensirion");
-    mqttServerIp = prefs.getString("mqttServerIp", "192.168.1.10");
-    mqttServerPort = prefs.getInt("mqttServerPort", 1883);
-    mqttEnabled = prefs.getBool("mqttEnabled", true);
+    applyPowerMode();
+    pipeline.stateCache().seed(random(0x7fffffff));
+
+    pipeline.setClientId(WiFi.macAddress().c_str());
+    pipeline.setChipId(platformChipId());
 
     server.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
-        request->send(200, "text/html", genHtml(stateTopic, mqttServerIp.c_str(), String(mqttServerPort), mqttEnabled));
+        HTTP_HANDLER_METRICS();
+        sendConfigPage(request, webSettings());
     });
     // Send a GET request to <IP>/get?message=<message>
     server.on("/get", HTTP_GET, [] (AsyncWebServerRequest *request) {
-        String topic = stateTopic;
-        mqttEnabled = false;
+        HTTP_HANDLER_METRICS();
+        Settings settings = webSettings();
+        char error[64] = "";
+
+        // Rather than cut off or taken as some port, too long values and a
+        // bad port reject the whole form.
+        if (request->hasParam(TOPIC_MESSAGE) &&
+            request->getParam(TOPIC_MESSAGE)->value().length() >= sizeof(settings.stateTopic)) {
+            snprintf(error, sizeof(error), "the MQTT topic is longer than %u characters",
+                     (unsigned) sizeof(settings.stateTopic) - 1);
+        } else if (request->hasParam(SERVER_IP_MESSAGE) &&
+                   request->getParam(SERVER_IP_MESSAGE)->value().length() >= sizeof(settings.mqttServer)) {
+            snprintf(error, sizeof(error), "the MQTT server is longer than %u characters",
+                     (unsigned) sizeof(settings.mqttServer) - 1);
+        } else if (request->hasParam(SERVER_PORT_MESSAGE) &&
+                   parsePort(request->getParam(SERVER_PORT_MESSAGE)->value().c_str()) == 0) {
+            snprintf(error, sizeof(error), "the MQTT port is not a number from 1 to 65535");
+        }
+        if (error[0]) {
+            LOG_WARN("Settings rejected: %s", error);
+            sendConfigPage(request, settings, error);
+            return;
+        }
+
+        settings.mqttEnabled = false;
         if (request->hasParam(TOPIC_MESSAGE)) {
-            topic = request->getParam(TOPIC_MESSAGE)->value();
-            stateTopic = topic;
-            prefs.putString("mqttStateTopic", topic);
-        } 
+            snprintf(settings.stateTopic, sizeof(settings.stateTopic), "%s",
+                     request->getParam(TOPIC_MESSAGE)->value().c_str());
+        }
         if (request->hasParam(SERVER_IP_MESSAGE)) {
-            mqttServerIp = request->getParam(SERVER_IP_MESSAGE)->value();
-            prefs.putString("mqttServerIp", mqttServerIp);
+            snprintf(settings.mqttServer, sizeof(settings.mqttServer), "%s",
+                     request->getParam(SERVER_IP_MESSAGE)->value().c_str());
         }
         if (request->hasParam(SERVER_PORT_MESSAGE)) {
-            mqttServerPort = atoi(request->getParam(SERVER_PORT_MESSAGE)->value().c_str());
-            prefs.putInt("mqttServerPort", mqttServerPort);
+            settings.mqttPort = parsePort(request->getParam(SERVER_PORT_MESSAGE)->value().c_str());
         }
         if (request->hasParam(MQTT_ENABLED_MESSAGE)) {
-            mqttEnabled = request->getParam(MQTT_ENABLED_MESSAGE)->value() == "Yes";
+            settings.mqttEnabled = request->getParam(MQTT_ENABLED_MESSAGE)->value() == "Yes";
+        }
+        if (request->hasParam(PUBLISH_INTERVAL_MESSAGE)) {
+            settings.publishInterval = constrain(request->getParam(PUBLISH_INTERVAL_MESSAGE)->value().toInt(),
+                                                 PUBLISH_INTERVAL_MIN, PUBLISH_INTERVAL_MAX);
+        }
+        if (request->hasParam(HEARTBEAT_MESSAGE)) {
+            settings.heartbeat = constrain(request->getParam(HEARTBEAT_MESSAGE)->value().toInt(),
+                                           HEARTBEAT_MIN, HEARTBEAT_MAX);
+        }
+        if (request->hasParam(BATCH_SIZE_MESSAGE)) {
+            settings.batchSize = constrain(request->getParam(BATCH_SIZE_MESSAGE)->value().toInt(), 0,
+                                           SAMPLE_BATCH_CAPACITY);
+        }
+        if (request->hasParam(POWER_MODE_MESSAGE)) {
+            String name = request->getParam(POWER_MODE_MESSAGE)->value();
+            for (size_t i = 0; i < sizeof(POWER_MODE_NAMES) / sizeof(POWER_MODE_NAMES[0]); i++) {
+                if (name == POWER_MODE_NAMES[i]) {
+                    settings.powerMode = i;
+                }
+            }
+        }
+        if (request->hasParam(WARM_START_MESSAGE)) {
+            settings.warmStart = constrain(request->getParam(WARM_START_MESSAGE)->value().toInt(), 0, 65535);
+        }
+        if (request->hasParam(RHT_ACCELERATION_MESSAGE)) {
+            settings.rhtAcceleration = constrain(request->getParam(RHT_ACCELERATION_MESSAGE)->value().toInt(),
+                                                 SEN5X_RHT_ACCELERATION_LOW, SEN5X_RHT_ACCELERATION_MEDIUM);
+        }
+        if (request->hasParam(BATCH_ENCODING_MESSAGE)) {
+            BatchEncoding encoding = (BatchEncoding) settings.batchEncoding;
+            parseBatchEncoding(request->getParam(BATCH_ENCODING_MESSAGE)->value().c_str(), encoding);
+            settings.batchEncoding = (uint8_t) encoding;
+        }
+        for (const SensorDescriptor& sensor : SENSOR_DESCRIPTORS) {
+            char name[16];
+            snprintf(name, sizeof(name), "%s%s", DEADBAND_PREFIX, sensor.key);
+            if (!request->hasParam(name)) {
+                continue;
+            }
+            settings.deadbandThreshold[(size_t) sensor.field] = max(request->getParam(name)->value().toFloat(), 0.0f);
+            // Unchecked boxes are not sent, the threshold tells the form was.
+            snprintf(name, sizeof(name), "%s%s", DEADBAND_RELATIVE_PREFIX, sensor.key);
+            settings.deadbandRelative[(size_t) sensor.field] = request->hasParam(name);
+        }
+        // This runs in the AsyncTCP task on the ESP32, loop() takes the
+        // settings into use.
+        {
+            SettingsLock lock;
+            pendingSettings = settings;
+            settingsPending = true;
         }
-        prefs.putBool("mqttEnabled", mqttEnabled); // Always write this to catch the Enable checkbox not checked also.
         
-        request->send(200, "text/html", genHtml(topic, mqttServerIp, String(mqttServerPort), mqttEnabled));
+        sendConfigPage(request, settings);
     });
     
+    // Served straight from the state cache, with an ETag so pollers get a
+    // 304 until the next window is published.
     server.on("/data", HTTP_GET, [](AsyncWebServerRequest *request) {
-        String response;
-        serializeJson(sensordata, response);
-        request->send(200, "application/json", response);
+        BENCH_SCOPE("/data");
+        HTTP_HANDLER_METRICS();
+        // Handlers run one at a time in the TCP task.
+        static char body[STATE_PAYLOAD_SIZE];
+        char etag[16];
+        uint32_t generation;
+        AsyncWebServerResponse *response;
+
+        size_t length = pipeline.stateCache().copy(body, sizeof(body), generation);
+        snprintf(etag, sizeof(etag), "\"%08x\"", (unsigned) generation);
+        if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == etag) {
+            response = request->beginResponse(304);
+        } else {
+            // The stream owns a copy of the body, later windows can not
+            // change it while a slow client is still receiving it.
+            AsyncResponseStream *stream = request->beginResponseStream("application/json", length);
+            stream->write((const uint8_t*) body, length);
+            response = stream;
+        }
+        response->addHeader("ETag", etag);
+        response->addHeader("Cache-Control", "no-cache");
+        request->send(response);
     });
 
+    // /history?field=<state key>&res=raw|1m|15m[&format=json|csv], streamed
+    // in chunks straight from the history tiers.
+    server.on("/history", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HTTP_HANDLER_METRICS();
+        HistoryQuery query;
+        const char* params[3] = {};
+        const char* names[3] = {"field", "res", "format"};
+
+        for (size_t i = 0; i < 3; i++) {
+            if (request->hasParam(names[i])) {
+                params[i] = request->getParam(names[i])->value().c_str();
+            }
+        }
+        if (!parseHistoryQuery(params[0], params[1], params[2], millis() / 1000, query)) {
+            request->send(400, "text/plain", "Expected field=<state key>&res=raw|1m|15m[&format=json|csv]");
+            return;
+        }
+        const char* contentType = query.format == HistoryFormat::Csv ? "text/csv" : "application/json";
+        request->send(request->beginChunkedResponse(contentType,
+                [query](uint8_t* buffer, size_t maxLen, size_t index) mutable -> size_t {
+            BENCH_SCOPE("/history");
+            (void) index;
+            return formatHistory(history, query, (char*) buffer, maxLen);
+        }));
+    });
+
+    // Publish the discovery messages again even if they did not change.
+    server.on("/discovery/refresh", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HTTP_HANDLER_METRICS();
+        pipeline.requestDiscovery(true);
+        request->send(200, "text/plain", "Discovery refresh scheduled");
+    });
+
+    // Counters and latency histograms in the Prometheus text format.
+    server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+        HTTP_HANDLER_METRICS();
+        AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+        writeMetricsPrometheus(metrics, [](void* context, const char* text) {
+            ((Print*) context)->print(text);
+        }, response);
+        response->printf("# TYPE envsensor_free_heap_bytes gauge\nenvsensor_free_heap_bytes %u\n",
+                         (unsigned) ESP.getFreeHeap());
+        response->printf("# TYPE envsensor_uptime_seconds gauge\nenvsensor_uptime_seconds %lu\n",
+                         millis() / 1000);
+        response->printf("# TYPE envsensor_settings_writes_total counter\nenvsensor_settings_writes_total %u\n",
+                         (unsigned) settingsStore.writes());
+#ifdef SAMPLING_TASK
+        response->printf("# TYPE envsensor_windows_dropped_total counter\nenvsensor_windows_dropped_total %u\n",
+                         (unsigned) windowQueue.dropped());
+#endif
+        request->send(response);
+    });
+
+    liveStream.begin(server);
     server.onNotFound(notFound);
     server.begin();
+
+#ifdef SAMPLING_TASK
+    sensorMutex = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(samplingTask, "sampling", SAMPLING_TASK_STACK, nullptr, SAMPLING_TASK_PRIORITY,
+                            nullptr, SAMPLING_TASK_CORE);
+#endif
 }
 
 
 void loop() {
-    static unsigned long previousMillis = 0;
     unsigned long currentMillis = millis();
-    SensirionMeasurement data;
 
-    if (mqttEnabled) {
-        mqttClient.loop();
+#ifdef ENABLE_BENCH
+    static unsigned long previousReport = 0;
+    if (currentMillis - previousReport >= 60000) {
+        previousReport = currentMillis;
+        benchReport();
+    }
+#endif
+    BENCH_SCOPE("loop");
+    LatencyTimer loopTimer(metrics.loop);
+
+    applyPendingSettings(currentMillis);
+    pipeline.loop(currentMillis);
+    if (pipeline.discoveryHash() != storedDiscoveryHash) {
+        storedDiscoveryHash = pipeline.discoveryHash();
+        prefs.putUInt("discoveryHash", storedDiscoveryHash);
     }
 
-    if (currentMillis - previousMillis >= 10000) {
-        //restart this TIMER
-        previousMillis = currentMillis;
-       
-        data = readSen5xData();
-
-        if (mqttEnabled) {
-            reconnectMQTT();
-            sendMQTT(data);
+#ifdef SAMPLING_TASK
+    publishClosedWindows();
+    publishLiveSamples();
+    saveVocStates();
+#else
+    sampleSensor(currentMillis);
+#endif
+    settingsStore.loop(currentMillis);
+
+    if (powerMode != PowerMode::AlwaysOn) {
+        // The core enters modem or light sleep while delay() waits.
+        unsigned long idle = samplingIdleTime(millis());
+        if (idle > 0) {
+            delay(idle);
+            BENCH_IDLE(idle);
         }
     }
+#ifdef SAMPLING_TASK
+    // Nothing here is time critical, give the idle task of this core a turn
+    // so it can feed the task watchdog.
+    delay(1);
+#endif
 }
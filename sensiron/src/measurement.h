@@ -0,0 +1,156 @@
+#ifndef MEASUREMENT_H
+#define MEASUREMENT_H
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The values of a measurement, in the order the sensor reports them.
+enum class SensorField : uint8_t {
+    Pm1p0,
+    Pm2p5,
+    Pm4p0,
+    Pm10p0,
+    Humidity,
+    Temperature,
+    VocIndex,
+    NoxIndex
+};
+
+const size_t SENSOR_FIELD_COUNT = 8;
+
+// One SEN5x sample in the sensor's native fixed point format, 16 bytes
+// instead of 32 for eight floats. Scaling as in the SEN5x datasheet
+// (Read Measured Values, 0x03C4):
+//   mass concentration  uint16  / 10   ug/m3  0xFFFF if unknown
+//   humidity            int16   / 100  %RH    0x7FFF if unknown
+//   temperature         int16   / 200  degC   0x7FFF if unknown
+//   voc and nox index   int16   / 10          0x7FFF if unknown
+// The float accessors return NAN for unknown values.
+struct SensirionMeasurement
+{
+    static constexpr uint16_t UNKNOWN_UNSIGNED = 0xFFFF;
+    static constexpr int16_t UNKNOWN_SIGNED = 0x7FFF;
+
+    static constexpr int PM_SCALE = 10;
+    static constexpr int HUMIDITY_SCALE = 100;
+    static constexpr int TEMPERATURE_SCALE = 200;
+    static constexpr int INDEX_SCALE = 10;
+
+    uint16_t rawPm1p0 = UNKNOWN_UNSIGNED;
+    uint16_t rawPm2p5 = UNKNOWN_UNSIGNED;
+    uint16_t rawPm4p0 = UNKNOWN_UNSIGNED;
+    uint16_t rawPm10p0 = UNKNOWN_UNSIGNED;
+    int16_t rawHumidity = UNKNOWN_SIGNED;
+    int16_t rawTemperature = UNKNOWN_SIGNED;
+    int16_t rawVocIndex = UNKNOWN_SIGNED;
+    int16_t rawNoxIndex = UNKNOWN_SIGNED;
+
+    float massConcentrationPm1p0() const { return toFloat(rawPm1p0, PM_SCALE); }
+    float massConcentrationPm2p5() const { return toFloat(rawPm2p5, PM_SCALE); }
+    float massConcentrationPm4p0() const { return toFloat(rawPm4p0, PM_SCALE); }
+    float massConcentrationPm10p0() const { return toFloat(rawPm10p0, PM_SCALE); }
+    float ambientHumidity() const { return toFloat(rawHumidity, HUMIDITY_SCALE); }
+    float ambientTemperature() const { return toFloat(rawTemperature, TEMPERATURE_SCALE); }
+    float vocIndex() const { return toFloat(rawVocIndex, INDEX_SCALE); }
+    float noxIndex() const { return toFloat(rawNoxIndex, INDEX_SCALE); }
+
+    void setMassConcentrationPm1p0(float value) { rawPm1p0 = toUnsigned(value, PM_SCALE); }
+    void setMassConcentrationPm2p5(float value) { rawPm2p5 = toUnsigned(value, PM_SCALE); }
+    void setMassConcentrationPm4p0(float value) { rawPm4p0 = toUnsigned(value, PM_SCALE); }
+    void setMassConcentrationPm10p0(float value) { rawPm10p0 = toUnsigned(value, PM_SCALE); }
+    void setAmbientHumidity(float value) { rawHumidity = toSigned(value, HUMIDITY_SCALE); }
+    void setAmbientTemperature(float value) { rawTemperature = toSigned(value, TEMPERATURE_SCALE); }
+    void setVocIndex(float value) { rawVocIndex = toSigned(value, INDEX_SCALE); }
+    void setNoxIndex(float value) { rawNoxIndex = toSigned(value, INDEX_SCALE); }
+
+    // Field access for code that is driven by the sensor descriptor table.
+    int32_t raw(SensorField field) const {
+        switch (field) {
+        case SensorField::Pm1p0: return rawPm1p0;
+        case SensorField::Pm2p5: return rawPm2p5;
+        case SensorField::Pm4p0: return rawPm4p0;
+        case SensorField::Pm10p0: return rawPm10p0;
+        case SensorField::Humidity: return rawHumidity;
+        case SensorField::Temperature: return rawTemperature;
+        case SensorField::VocIndex: return rawVocIndex;
+        case SensorField::NoxIndex: return rawNoxIndex;
+        }
+        return 0;
+    }
+
+    bool known(SensorField field) const {
+        return isUnsigned(field) ? raw(field) != UNKNOWN_UNSIGNED : raw(field) != UNKNOWN_SIGNED;
+    }
+
+    float value(SensorField field) const {
+        return known(field) ? (float) raw(field) / scale(field) : NAN;
+    }
+
+    void setValue(SensorField field, float value) {
+        switch (field) {
+        case SensorField::Pm1p0: setMassConcentrationPm1p0(value); break;
+        case SensorField::Pm2p5: setMassConcentrationPm2p5(value); break;
+        case SensorField::Pm4p0: setMassConcentrationPm4p0(value); break;
+        case SensorField::Pm10p0: setMassConcentrationPm10p0(value); break;
+        case SensorField::Humidity: setAmbientHumidity(value); break;
+        case SensorField::Temperature: setAmbientTemperature(value); break;
+        case SensorField::VocIndex: setVocIndex(value); break;
+        case SensorField::NoxIndex: setNoxIndex(value); break;
+        }
+    }
+
+    static bool isUnsigned(SensorField field) {
+        return field <= SensorField::Pm10p0;
+    }
+
+    static int scale(SensorField field) {
+        switch (field) {
+        case SensorField::Humidity: return HUMIDITY_SCALE;
+        case SensorField::Temperature: return TEMPERATURE_SCALE;
+        case SensorField::VocIndex:
+        case SensorField::NoxIndex: return INDEX_SCALE;
+        default: return PM_SCALE;
+        }
+    }
+
+    static float toFloat(uint16_t raw, int scale) {
+        return raw == UNKNOWN_UNSIGNED ? NAN : (float) raw / scale;
+    }
+
+    static float toFloat(int16_t raw, int scale) {
+        return raw == UNKNOWN_SIGNED ? NAN : (float) raw / scale;
+    }
+
+    // Rounds to the nearest step, out of range values saturate just below
+    // the unknown marker.
+    static uint16_t toUnsigned(float value, int scale) {
+        if (isnan(value)) {
+            return UNKNOWN_UNSIGNED;
+        }
+        float scaled = roundf(value * scale);
+        if (scaled <= 0.0f) {
+            return 0;
+        }
+        if (scaled >= UNKNOWN_UNSIGNED - 1) {
+            return UNKNOWN_UNSIGNED - 1;
+        }
+        return (uint16_t) scaled;
+    }
+
+    static int16_t toSigned(float value, int scale) {
+        if (isnan(value)) {
+            return UNKNOWN_SIGNED;
+        }
+        float scaled = roundf(value * scale);
+        if (scaled <= -32768.0f) {
+            return -32768;
+        }
+        if (scaled >= UNKNOWN_SIGNED - 1) {
+            return UNKNOWN_SIGNED - 1;
+        }
+        return (int16_t) scaled;
+    }
+};
+
+static_assert(sizeof(SensirionMeasurement) == 16, "SensirionMeasurement should stay packed");
+#endif
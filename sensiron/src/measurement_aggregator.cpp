@@ -0,0 +1,77 @@
+#include <math.h>
+#include "measurement_aggregator.h"
+
+RunningStats::RunningStats() {
+    reset();
+}
+
+void RunningStats::reset() {
+    _count = 0;
+    _mean = 0.0;
+    _m2 = 0.0;
+    _min = NAN;
+    _max = NAN;
+}
+
+void RunningStats::add(float value) {
+    if (isnan(value)) {
+        return;
+    }
+    _count++;
+    double delta = value - _mean;
+    _mean += delta / _count;
+    _m2 += delta * (value - _mean);
+
+    if (_count == 1 || value < _min) {
+        _min = value;
+    }
+    if (_count == 1 || value > _max) {
+        _max = value;
+    }
+}
+
+float RunningStats::mean() const {
+    return _count ? (float) _mean : NAN;
+}
+
+float RunningStats::min() const {
+    return _min;
+}
+
+float RunningStats::max() const {
+    return _max;
+}
+
+float RunningStats::stddev() const {
+    if (_count == 0) {
+        return NAN;
+    }
+    if (_count == 1) {
+        return 0.0f;
+    }
+    return (float) sqrt(_m2 / (_count - 1));
+}
+
+
+void MeasurementAggregator::reset() {
+    for (RunningStats& stats : _stats) {
+        stats.reset();
+    }
+    _count = 0;
+}
+
+void MeasurementAggregator::add(const SensirionMeasurement& data) {
+    for (size_t i = 0; i < SENSOR_FIELD_COUNT; i++) {
+        _stats[i].add(data.value((SensorField) i));
+    }
+    _count++;
+}
+
+SensirionMeasurement MeasurementAggregator::mean() const {
+    SensirionMeasurement data;
+
+    for (size_t i = 0; i < SENSOR_FIELD_COUNT; i++) {
+        data.setValue((SensorField) i, _stats[i].mean());
+    }
+    return data;
+}
@@ -0,0 +1,50 @@
+#ifndef MEASUREMENT_AGGREGATOR_H
+#define MEASUREMENT_AGGREGATOR_H
+#include <stdint.h>
+
+#include "measurement.h"
+
+// Streaming statistics of one value in O(1) memory, mean and variance use
+// Welford's algorithm so they stay accurate over long windows.
+class RunningStats {
+public:
+    RunningStats();
+
+    void reset();
+    void add(float value);
+
+    uint32_t count() const { return _count; }
+    // All of these return NAN when no value was added.
+    float mean() const;
+    float min() const;
+    float max() const;
+    // Sample standard deviation, 0 for a single value.
+    float stddev() const;
+
+private:
+    uint32_t _count;
+    double _mean;
+    double _m2;
+    float _min;
+    float _max;
+};
+
+
+// Statistics of every field of the measurements taken in one publish window.
+// Unknown values reported by the sensor are left out.
+class MeasurementAggregator {
+public:
+    void reset();
+    void add(const SensirionMeasurement& data);
+
+    // Number of measurements added since the last reset.
+    uint32_t count() const { return _count; }
+    const RunningStats& stats(SensorField field) const { return _stats[(size_t) field]; }
+    // The window means, rounded to the sensor's resolution.
+    SensirionMeasurement mean() const;
+
+private:
+    RunningStats _stats[SENSOR_FIELD_COUNT];
+    uint32_t _count = 0;
+};
+#endif
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include "metrics.h"
+
+Metrics metrics;
+
+const uint32_t LatencyHistogram::BOUNDS[LatencyHistogram::BUCKETS] = {
+    100, 500, 1000, 5000, 10000, 25000, 50000, 100000, 1000000
+};
+
+void LatencyHistogram::observe(uint32_t micros) {
+    size_t i = 0;
+
+    while (i < BUCKETS && micros > BOUNDS[i]) {
+        i++;
+    }
+    _buckets[i]++;
+    _count++;
+    _sum.store(_sum.load() + micros);
+    if (micros > _max.load()) {
+        _max.store(micros);
+    }
+}
+
+static void writeCounter(MetricsOutput output, void* context, const char* name, const char* help, uint32_t value) {
+    char line[256];
+
+    snprintf(line, sizeof(line), "# HELP envsensor_%s %s\n# TYPE envsensor_%s counter\nenvsensor_%s %lu\n",
+             name, help, name, name, (unsigned long) value);
+    output(context, line);
+}
+
+static void writeHistogram(MetricsOutput output, void* context, const char* name, const char* help,
+                           const LatencyHistogram& histogram) {
+    char line[256];
+    uint32_t cumulative = 0;
+
+    snprintf(line, sizeof(line), "# HELP envsensor_%s_seconds %s\n# TYPE envsensor_%s_seconds histogram\n",
+             name, help, name);
+    output(context, line);
+    for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+        cumulative += histogram.bucket(i);
+        snprintf(line, sizeof(line), "envsensor_%s_seconds_bucket{le=\"%lu.%06lu\"} %lu\n", name,
+                 (unsigned long) (LatencyHistogram::BOUNDS[i] / 1000000),
+                 (unsigned long) (LatencyHistogram::BOUNDS[i] % 1000000), (unsigned long) cumulative);
+        output(context, line);
+    }
+    snprintf(line, sizeof(line),
+             "envsensor_%s_seconds_bucket{le=\"+Inf\"} %lu\nenvsensor_%s_seconds_sum %lu.%06lu\n"
+             "envsensor_%s_seconds_count %lu\n",
+             name, (unsigned long) histogram.count(), name, (unsigned long) (histogram.sum() / 1000000),
+             (unsigned long) (histogram.sum() % 1000000), name, (unsigned long) histogram.count());
+    output(context, line);
+}
+
+void writeMetricsPrometheus(const Metrics& metrics, MetricsOutput output, void* context) {
+    writeHistogram(output, context, "loop", "Duration of a main loop iteration.", metrics.loop);
+    writeHistogram(output, context, "i2c_read", "Duration of SEN5x I2C reads.", metrics.i2cRead);
+    writeHistogram(output, context, "i2c_write", "Duration of SEN5x I2C command writes.", metrics.i2cWrite);
+    writeHistogram(output, context, "mqtt_connect", "Duration of MQTT connect attempts.", metrics.mqttConnect);
+    writeHistogram(output, context, "mqtt_publish", "Duration of MQTT publishes.", metrics.mqttPublish);
+    writeHistogram(output, context, "http_handler", "Duration of HTTP handlers.", metrics.httpHandler);
+
+    writeCounter(output, context, "samples_total", "Samples read from the SEN5x.", metrics.samples.load());
+    writeCounter(output, context, "i2c_errors_total", "Failed SEN5x I2C commands.", metrics.i2cErrors.load());
+    writeCounter(output, context, "i2c_crc_errors_total", "SEN5x responses with a bad CRC.",
+                 metrics.i2cCrcErrors.load());
+    writeCounter(output, context, "i2c_retries_total", "SEN5x reads requested again after a failure.",
+                 metrics.i2cRetries.load());
+    writeCounter(output, context, "i2c_recoveries_total", "I2C bus recoveries after repeated failures.",
+                 metrics.i2cRecoveries.load());
+    writeCounter(output, context, "mqtt_connect_failures_total", "Failed MQTT connect attempts.",
+                 metrics.mqttConnectFailures.load());
+    writeCounter(output, context, "mqtt_publishes_total", "MQTT messages published.", metrics.mqttPublishes.load());
+    writeCounter(output, context, "mqtt_publish_failures_total", "MQTT publishes that failed.",
+                 metrics.mqttPublishFailures.load());
+    writeCounter(output, context, "publishes_suppressed_total", "Windows not published by the report filter.",
+                 metrics.publishesSuppressed.load());
+    writeCounter(output, context, "http_requests_total", "HTTP requests handled.", metrics.httpRequests.load());
+    writeCounter(output, context, "live_frames_total", "Samples pushed to the live stream clients.",
+                 metrics.liveFrames.load());
+    writeCounter(output, context, "live_clients_dropped_total",
+                 "Live stream clients rejected over the limit or disconnected for falling behind.",
+                 metrics.liveClientsDropped.load());
+}
+
+static int formatHistogramJson(char* buf, size_t size, const char* name, const LatencyHistogram& histogram) {
+    return snprintf(buf, size, "\"%s\":[%lu,%lu,%lu],", name, (unsigned long) histogram.count(),
+                    (unsigned long) (histogram.count() ? histogram.sum() / histogram.count() : 0),
+                    (unsigned long) histogram.max());
+}
+
+size_t formatMetricsJson(const Metrics& metrics, char* buf, size_t size) {
+    size_t pos = 0;
+    int n = snprintf(buf, size,
+                     "{\"samples\":%lu,\"i2c_errors\":%lu,\"i2c_crc_errors\":%lu,\"i2c_retries\":%lu,"
+                     "\"i2c_recoveries\":%lu,\"mqtt_connect_failures\":%lu,\"mqtt_publishes\":%lu,"
+                     "\"mqtt_publish_failures\":%lu,\"suppressed\":%lu,\"http_requests\":%lu,\"live_frames\":%lu,"
+                     "\"live_clients_dropped\":%lu,",
+                     (unsigned long) metrics.samples.load(), (unsigned long) metrics.i2cErrors.load(),
+                     (unsigned long) metrics.i2cCrcErrors.load(), (unsigned long) metrics.i2cRetries.load(),
+                     (unsigned long) metrics.i2cRecoveries.load(),
+                     (unsigned long) metrics.mqttConnectFailures.load(), (unsigned long) metrics.mqttPublishes.load(),
+                     (unsigned long) metrics.mqttPublishFailures.load(),
+                     (unsigned long) metrics.publishesSuppressed.load(),
+                     (unsigned long) metrics.httpRequests.load(), (unsigned long) metrics.liveFrames.load(),
+                     (unsigned long) metrics.liveClientsDropped.load());
+    if (n < 0 || (size_t) n >= size) {
+        return 0;
+    }
+    pos = n;
+
+    // Histograms as [count, mean us, max us].
+    const struct {
+        const char* name;
+        const LatencyHistogram& histogram;
+    } histograms[] = {
+        {"loop_us", metrics.loop},
+        {"i2c_read_us", metrics.i2cRead},
+        {"i2c_write_us", metrics.i2cWrite},
+        {"mqtt_connect_us", metrics.mqttConnect},
+        {"mqtt_publish_us", metrics.mqttPublish},
+        {"http_handler_us", metrics.httpHandler},
+    };
+    for (const auto& entry : histograms) {
+        n = formatHistogramJson(buf + pos, size - pos, entry.name, entry.histogram);
+        if (n < 0 || (size_t) n >= size - pos) {
+            return 0;
+        }
+        pos += n;
+    }
+    buf[pos - 1] = '}';
+    return pos;
+}
@@ -0,0 +1,105 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <stddef.h>
+#include <stdint.h>
+#ifndef ESP8266
+#include <atomic>
+#endif
+
+// Always on runtime counters and latency histograms, cheap enough to be
+// updated on every loop iteration. Served on /metrics in the Prometheus
+// text format and optionally published on the diagnostics topic.
+
+// A metric updated from the loop, the sampling task and the AsyncTCP task on
+// the ESP32. Relaxed, nothing else is ordered by the metrics, a reader only
+// needs whole values. The ESP8266 runs one context at a time on its single
+// core and has no atomic instructions, a plain value does there.
+template <typename T>
+class MetricValue {
+public:
+    T load() const {
+#ifdef ESP8266
+        return _value;
+#else
+        return _value.load(std::memory_order_relaxed);
+#endif
+    }
+
+    void store(T value) {
+#ifdef ESP8266
+        _value = value;
+#else
+        _value.store(value, std::memory_order_relaxed);
+#endif
+    }
+
+    void operator++(int) {
+#ifdef ESP8266
+        _value++;
+#else
+        _value.fetch_add(1, std::memory_order_relaxed);
+#endif
+    }
+
+private:
+#ifdef ESP8266
+    T _value = 0;
+#else
+    std::atomic<T> _value{0};
+#endif
+};
+
+// Fixed bucket latency histogram, bounds in microseconds. Each histogram is
+// observed from one context only, it may be read from any.
+class LatencyHistogram {
+public:
+    static const size_t BUCKETS = 9;
+    static const uint32_t BOUNDS[BUCKETS];
+
+    void observe(uint32_t micros);
+
+    uint32_t count() const { return _count.load(); }
+    uint64_t sum() const { return _sum.load(); }
+    uint32_t max() const { return _max.load(); }
+    // Observations in bucket i only, not cumulative. BUCKETS is +Inf.
+    uint32_t bucket(size_t i) const { return _buckets[i].load(); }
+
+private:
+    MetricValue<uint32_t> _buckets[BUCKETS + 1];
+    MetricValue<uint32_t> _count;
+    MetricValue<uint64_t> _sum;
+    MetricValue<uint32_t> _max;
+};
+
+struct Metrics {
+    LatencyHistogram loop;
+    LatencyHistogram i2cRead;
+    LatencyHistogram i2cWrite;
+    LatencyHistogram mqttConnect;
+    LatencyHistogram mqttPublish;
+    LatencyHistogram httpHandler;
+
+    MetricValue<uint32_t> samples;
+    MetricValue<uint32_t> i2cErrors;
+    MetricValue<uint32_t> i2cCrcErrors;
+    MetricValue<uint32_t> i2cRetries;
+    MetricValue<uint32_t> i2cRecoveries;
+    MetricValue<uint32_t> mqttConnectFailures;
+    MetricValue<uint32_t> mqttPublishes;
+    MetricValue<uint32_t> mqttPublishFailures;
+    MetricValue<uint32_t> publishesSuppressed;
+    MetricValue<uint32_t> httpRequests;
+    MetricValue<uint32_t> liveFrames;
+    MetricValue<uint32_t> liveClientsDropped;
+};
+
+extern Metrics metrics;
+
+// Receives the formatted text piece by piece.
+typedef void (*MetricsOutput)(void* context, const char* text);
+
+void writeMetricsPrometheus(const Metrics& metrics, MetricsOutput output, void* context);
+// Compact json summary, counters and count/sum/max of the histograms.
+size_t formatMetricsJson(const Metrics& metrics, char* buf, size_t size);
+
+#endif
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+#include "log.h"
+#include "metrics.h"
+#include "mqtt_connection.h"
+
+MqttConnection::MqttConnection(MqttClient& client, Clock& clock)
+    : _client(client), _clock(clock), _backoff(1000, 60000) {
+    _host[0] = '\0';
+    _port = 1883;
+    _clientId[0] = '\0';
+    _lastAttempt = 0;
+    _wait = 0;
+}
+
+void MqttConnection::setServer(const char* host, uint16_t port) {
+    if (strcmp(host, _host) != 0 || port != _port) {
+        snprintf(_host, sizeof(_host), "%s", host);
+        _port = port;
+        disconnect();
+    }
+}
+
+void MqttConnection::setClientId(const char* clientId) {
+    snprintf(_clientId, sizeof(_clientId), "%s", clientId);
+}
+
+bool MqttConnection::loop(unsigned long now) {
+    if (_client.connected()) {
+        _client.loop();
+        return false;
+    }
+
+    if (now - _lastAttempt < _wait) {
+        return false;
+    }
+    _lastAttempt = now;
+
+    // PubSubClient keeps the pointer, _host outlives the client connection.
+    _client.setServer(_host, _port);
+    uint32_t start = _clock.micros();
+    bool connected = _client.connect(_clientId);
+    metrics.mqttConnect.observe(_clock.micros() - start);
+    if (connected) {
+        _backoff.reset();
+        _wait = 0;
+        LOG_INFO("MQTT Connected");
+        return true;
+    }
+
+    metrics.mqttConnectFailures++;
+    _wait = _backoff.nextDelay(_clock.random());
+    LOG_WARN("MQTT Not Connected, state %d, retry in %lu ms", _client.state(), _wait);
+    return false;
+}
+
+bool MqttConnection::connected() {
+    return _client.connected();
+}
+
+void MqttConnection::disconnect() {
+    if (_client.connected()) {
+        _client.disconnect();
+    }
+    _backoff.reset();
+    _wait = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef MQTT_CONNECTION_H
+#define MQTT_CONNECTION_H
+#include <stdint.h>
+
+#include "pipeline_io.h"
+#include "reconnect_backoff.h"
+#include "settings.h"
+
+// Non blocking connection manager for the mqtt client, call loop() on every
+// iteration of the main loop. At most one connect attempt is made per call so
+// sampling and the web server keep running while the broker is unreachable.
+class MqttConnection {
+public:
+    MqttConnection(MqttClient& client, Clock& clock);
+
+    // Disconnects when the server changed.
+    void setServer(const char* host, uint16_t port);
+    void setClientId(const char* clientId);
+
+    // Returns true once, on the call where the connection was (re)established.
+    bool loop(unsigned long now);
+    bool connected();
+    void disconnect();
+
+private:
+    MqttClient& _client;
+    Clock& _clock;
+    ReconnectBackoff _backoff;
+    char _host[sizeof(Settings::mqttServer)];
+    uint16_t _port;
+    char _clientId[32];
+    unsigned long _lastAttempt;
+    unsigned long _wait;
+};
+#endif
@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "fake_broker.h"
+
+FakeBroker::FakeBroker(SimClock& clock, unsigned long outageStart, unsigned long outageEnd)
+    : _clock(clock), _outageStart(outageStart), _outageEnd(outageEnd) {
+    _connected = false;
+    _connectAttempts = 0;
+    _messages = 0;
+    _bytes = 0;
+    _discoveryMessages = 0;
+    _replayed = 0;
+    _replayedOutOfOrder = 0;
+    _lastReplayed = 0;
+}
+
+void FakeBroker::setServer(const char* host, uint16_t port) {
+    (void) host;
+    (void) port;
+}
+
+bool FakeBroker::connect(const char* clientId) {
+    (void) clientId;
+    _connectAttempts++;
+    _connected = up();
+    return _connected;
+}
+
+bool FakeBroker::connected() {
+    if (_connected && !up()) {
+        _connected = false;
+    }
+    return _connected;
+}
+
+bool FakeBroker::publish(const char* topic, const uint8_t* payload, size_t length, bool retained) {
+    (void) retained;
+    if (!connected()) {
+        return false;
+    }
+    _messages++;
+    _bytes += length;
+
+    size_t topicLength = strlen(topic);
+    if (strncmp(topic, "homeassistant/", 14) == 0) {
+        _discoveryMessages++;
+    } else if (topicLength > 7 && strcmp(topic + topicLength - 7, "/replay") == 0) {
+        // The sample was taken age seconds before now.
+        std::string document((const char*) payload, length);
+        size_t age = document.find("\"age\":");
+        long taken = (long) (_clock.now() / 1000) - (age == std::string::npos ? 0 : atol(document.c_str() + age + 6));
+        if (_replayed > 0 && taken < _lastReplayed) {
+            _replayedOutOfOrder++;
+        }
+        _lastReplayed = taken;
+        _replayed++;
+    }
+    return true;
+}
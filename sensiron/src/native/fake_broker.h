@@ -0,0 +1,50 @@
+#ifndef FAKE_BROKER_H
+#define FAKE_BROKER_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../pipeline_io.h"
+#include "sim_clock.h"
+
+// Broker that is unreachable during [outageStart, outageEnd), a connection
+// that is open when the outage starts is dropped. Counts the messages it
+// accepts and checks that the replayed samples arrive oldest first.
+class FakeBroker : public MqttClient {
+public:
+    FakeBroker(SimClock& clock, unsigned long outageStart, unsigned long outageEnd);
+
+    void setServer(const char* host, uint16_t port) override;
+    bool connect(const char* clientId) override;
+    bool connected() override;
+    bool loop() override { return connected(); }
+    void disconnect() override { _connected = false; }
+    bool publish(const char* topic, const uint8_t* payload, size_t length, bool retained) override;
+    bool subscribe(const char*) override { return connected(); }
+    bool unsubscribe(const char*) override { return connected(); }
+    // MQTT_CONNECTION_TIMEOUT while the broker is down.
+    int state() override { return _connected ? 0 : -4; }
+
+    bool up() const { return _clock.now() < _outageStart || _clock.now() >= _outageEnd; }
+    uint32_t connectAttempts() const { return _connectAttempts; }
+    uint32_t messages() const { return _messages; }
+    uint64_t bytes() const { return _bytes; }
+    uint32_t discoveryMessages() const { return _discoveryMessages; }
+    uint32_t replayed() const { return _replayed; }
+    // Replayed samples that were older than one replayed before them.
+    uint32_t replayedOutOfOrder() const { return _replayedOutOfOrder; }
+
+private:
+    SimClock& _clock;
+    unsigned long _outageStart;
+    unsigned long _outageEnd;
+    bool _connected;
+    uint32_t _connectAttempts;
+    uint32_t _messages;
+    uint64_t _bytes;
+    uint32_t _discoveryMessages;
+    uint32_t _replayed;
+    uint32_t _replayedOutOfOrder;
+    // Seconds since boot of the sample replayed last.
+    long _lastReplayed;
+};
+#endif
@@ -0,0 +1,199 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../sample_history.h"
+#include "history_check.h"
+#include "sample_source.h"
+
+static const HistoryResolution RESOLUTIONS[] = {HistoryResolution::Raw, HistoryResolution::Minute,
+                                                HistoryResolution::QuarterHour};
+static const size_t CAPACITIES[] = {HISTORY_RAW_CAPACITY, HISTORY_MINUTE_CAPACITY, HISTORY_QUARTER_CAPACITY};
+
+static bool sameData(const SensirionMeasurement& a, const SensirionMeasurement& b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// Mean of the log entries in [from, to) like a rollup, computed on its own.
+static SensirionMeasurement expectedMean(const std::vector<HistoryEntry>& log, uint32_t from, uint32_t to) {
+    auto first = std::lower_bound(log.begin(), log.end(), from,
+                                  [](const HistoryEntry& entry, uint32_t time) { return entry.time < time; });
+    SensirionMeasurement mean;
+
+    for (size_t i = 0; i < SENSOR_FIELD_COUNT; i++) {
+        SensorField field = (SensorField) i;
+        int64_t sum = 0;
+        int64_t known = 0;
+        for (auto entry = first; entry != log.end() && entry->time < to; ++entry) {
+            if (entry->data.known(field)) {
+                sum += entry->data.raw(field);
+                known++;
+            }
+        }
+        if (known > 0) {
+            mean.setValue(field, (float) llround((double) sum / known) / SensirionMeasurement::scale(field));
+        }
+    }
+    return mean;
+}
+
+// Every tier holds the latest periods that are complete, each with the mean
+// of its samples.
+static bool checkTiers(const SampleHistory& history, const std::vector<HistoryEntry>& log) {
+    for (size_t r = 0; r < HISTORY_RESOLUTION_COUNT; r++) {
+        HistoryResolution resolution = RESOLUTIONS[r];
+        uint32_t interval = SampleHistory::interval(resolution);
+
+        // Periods that have samples, the last one is still open in a rollup.
+        std::vector<uint32_t> periods;
+        for (const HistoryEntry& entry : log) {
+            if (periods.empty() || entry.time / interval != periods.back()) {
+                periods.push_back(entry.time / interval);
+            }
+        }
+        size_t complete = resolution == HistoryResolution::Raw ? log.size() : periods.size() - 1;
+        size_t expected = std::min(complete, CAPACITIES[r] - 1);
+        uint32_t begin = history.begin(resolution), end = history.end(resolution);
+        if (end != complete || end - begin != expected) {
+            fprintf(stderr, "history: %u entries in tier %u, expected %u\n", (unsigned) (end - begin),
+                    (unsigned) r, (unsigned) expected);
+            return false;
+        }
+        for (uint32_t sequence = begin; sequence < end; sequence++) {
+            HistoryEntry entry;
+            if (!history.get(resolution, sequence, entry)) {
+                fprintf(stderr, "history: entry %u of tier %u not readable\n", sequence, (unsigned) r);
+                return false;
+            }
+            if (resolution == HistoryResolution::Raw) {
+                const HistoryEntry& logged = log[sequence];
+                if (entry.time != logged.time || !sameData(entry.data, logged.data)) {
+                    fprintf(stderr, "history: raw entry %u differs\n", sequence);
+                    return false;
+                }
+                continue;
+            }
+            uint32_t period = periods[sequence];
+            SensirionMeasurement mean = expectedMean(log, period * interval, (period + 1) * interval);
+            if (entry.time != period * interval || !sameData(entry.data, mean)) {
+                fprintf(stderr, "history: rollup %u of tier %u differs\n", sequence, (unsigned) r);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The response streamed through a small buffer matches the one written in a
+// single piece.
+static bool checkFormat(const SampleHistory& history, const char* field, const char* resolution,
+                        const char* format, size_t pieceSize, size_t& length) {
+    std::string pieces, whole;
+    std::vector<char> buf(65536);
+    HistoryQuery query;
+    size_t n;
+
+    if (!parseHistoryQuery(field, resolution, format, 1000000, query)) {
+        return false;
+    }
+    while ((n = formatHistory(history, query, buf.data(), pieceSize)) > 0) {
+        pieces.append(buf.data(), n);
+    }
+    parseHistoryQuery(field, resolution, format, 1000000, query);
+    while ((n = formatHistory(history, query, buf.data(), buf.size())) > 0) {
+        whole.append(buf.data(), n);
+    }
+    length = whole.size();
+    if (pieces != whole || whole.empty()) {
+        fprintf(stderr, "history: %s %s %s differs when streamed\n", field, resolution, format);
+        return false;
+    }
+    return true;
+}
+
+// A reader copying raw entries while another thread adds samples never sees
+// a torn entry.
+static bool checkConcurrent(uint32_t samples, uint32_t& reads) {
+    static SampleHistory history;
+    std::atomic<bool> done{false};
+    bool intact = true;
+
+    auto make = [](uint32_t time) {
+        SensirionMeasurement data;
+        data.rawPm1p0 = data.rawPm2p5 = data.rawPm4p0 = data.rawPm10p0 = (uint16_t) (time % 30000);
+        data.rawHumidity = data.rawTemperature = data.rawVocIndex = data.rawNoxIndex = (int16_t) (time % 30000);
+        return data;
+    };
+    std::thread reader([&] {
+        while (!done.load()) {
+            HistoryEntry entry;
+            uint32_t end = history.end(HistoryResolution::Raw);
+            for (uint32_t sequence = history.begin(HistoryResolution::Raw); sequence < end; sequence++) {
+                if (history.get(HistoryResolution::Raw, sequence, entry)) {
+                    reads++;
+                    intact = intact && entry.time == sequence && sameData(entry.data, make(entry.time));
+                }
+            }
+        }
+    });
+    for (uint32_t time = 0; time < samples; time++) {
+        history.add(time, make(time));
+    }
+    done.store(true);
+    reader.join();
+    return intact;
+}
+
+bool historyCheck(double hours) {
+    static SampleHistory history;
+    std::vector<HistoryEntry> log;
+    ScriptedSource source(42);
+    uint32_t end = (uint32_t) (hours * 3600);
+
+    for (uint32_t time = 0; time < end; time++) {
+        // A 20 minute outage in the second hour and some late samples.
+        if (time >= 4000 && time < 5200) {
+            continue;
+        }
+        if (time % 61 == 0) {
+            time++;
+        }
+        SensirionMeasurement data = source.sample(time * 1000UL);
+        if (time % 97 == 0) {
+            data.rawPm2p5 = SensirionMeasurement::UNKNOWN_UNSIGNED;
+        }
+        // A whole minute without temperature and a cold night below zero.
+        if (time / 60 == 100) {
+            data.rawTemperature = SensirionMeasurement::UNKNOWN_SIGNED;
+        } else if (time >= 7200 && time < 10800) {
+            data.rawTemperature -= 6000;
+        }
+        history.add(time, data);
+        log.push_back({time, data});
+    }
+
+    bool ok = checkTiers(history, log);
+    size_t lengths[HISTORY_RESOLUTION_COUNT * 2] = {};
+    const char* names[] = {"raw", "1m", "15m"};
+    for (size_t r = 0; ok && r < HISTORY_RESOLUTION_COUNT; r++) {
+        ok = checkFormat(history, "temperature", names[r], "json", 80, lengths[2 * r]) &&
+             checkFormat(history, "pm2p5", names[r], "csv", 80, lengths[2 * r + 1]);
+    }
+    uint32_t reads = 0;
+    ok = ok && checkConcurrent(2000000, reads);
+
+    printf("{\"history\":{\"simulated_hours\":%.2f,\"samples\":%u,\"bytes\":%u,\"entries\":[%u,%u,%u],"
+           "\"json_bytes\":[%u,%u,%u],\"csv_bytes\":[%u,%u,%u],\"concurrent_reads\":%u,\"ok\":%s}}\n",
+           hours, (unsigned) log.size(), (unsigned) sizeof(SampleHistory),
+           (unsigned) (history.end(HistoryResolution::Raw) - history.begin(HistoryResolution::Raw)),
+           (unsigned) (history.end(HistoryResolution::Minute) - history.begin(HistoryResolution::Minute)),
+           (unsigned) (history.end(HistoryResolution::QuarterHour) - history.begin(HistoryResolution::QuarterHour)),
+           (unsigned) lengths[0], (unsigned) lengths[2], (unsigned) lengths[4], (unsigned) lengths[1],
+           (unsigned) lengths[3], (unsigned) lengths[5], reads, ok ? "true" : "false");
+    return ok;
+}
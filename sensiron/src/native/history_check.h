@@ -0,0 +1,10 @@
+#ifndef HISTORY_CHECK_H
+#define HISTORY_CHECK_H
+
+// Feeds hours of scripted samples, with gaps and unknown values, into a
+// SampleHistory and checks every tier against means computed from the full
+// log, the streamed /history output against one written in a single piece,
+// and a reader thread against a concurrent writer. Prints a json summary,
+// returns false on the first mismatch.
+bool historyCheck(double hours);
+#endif
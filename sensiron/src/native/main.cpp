@@ -0,0 +1,235 @@
+// Native simulation of the firmware's sampling and publish pipeline. Runs the
+// device's SensorPipeline, with its scheduler, aggregation, report filter,
+// payload formatting, store and forward and MQTT connection handling, against
+// a simulated SEN5x and a fake broker on a fake clock, so a day of operation
+// takes seconds on the host. The loop sleeps between polls like it does in
+// the power saving modes. The exit status is 1 when a sample was missed, the
+// replay was out of order, a window went missing or the broker did not get
+// every message counted as published.
+//
+//   .pio/build/native/program [hours] [recording.csv]
+//   .pio/build/native/program spsc [items]
+//   .pio/build/native/program mux [sensors] [hours]
+//   .pio/build/native/program faults [crc rate] [stuck rate] [hours]
+//   .pio/build/native/program history [hours]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../bench.h"
+#include "../metrics.h"
+#include "../sample_batch.h"
+#include "../sen5x_protocol.h"
+#include "../sensor_pipeline.h"
+#include "../state_payload.h"
+#include "fake_broker.h"
+#include "history_check.h"
+#include "sample_source.h"
+#include "sen5x_sim.h"
+#include "mux_sim.h"
+#include "sim_clock.h"
+#include "spsc_stress.h"
+
+// Time one iteration of loop() takes when there is nothing to do.
+static const unsigned long LOOP_TICK_MS = 5;
+// Longest single sleep, POWER_MAX_IDLE_MS on the device.
+static const unsigned long MAX_IDLE_MS = 1000;
+
+// Publishes every window as soon as it is closed, like the single core
+// firmware does. The published windows are also collected in batches of
+// every encoding, for the payload size comparison only.
+class SimulationListener : public SampleListener {
+public:
+    static const size_t ENCODINGS = 3;
+
+    void sampleRead(size_t sensor, unsigned long now, const SensirionMeasurement& data) override {
+        (void) sensor;
+        (void) now;
+        (void) data;
+    }
+
+    void windowClosed(size_t sensor, unsigned long now, const MeasurementAggregator& window) override {
+        uint32_t published = metrics.mqttPublishes.load();
+
+        windows++;
+        pipeline->publishWindow(sensor, window, now);
+        if (metrics.mqttPublishes.load() == published) {
+            return;
+        }
+        stateBytes += pipeline->stateCache().length();
+        statePublishes++;
+        batch.add(now / 1000, window.mean());
+        if (batch.size() == SAMPLE_BATCH_CAPACITY) {
+            for (size_t i = 0; i < ENCODINGS; i++) {
+                batchBytes[i] += batch.encode(encodings[i], now / 1000, batchPayload, sizeof(batchPayload));
+            }
+            batchSamples += batch.size();
+            batch.clear();
+        }
+    }
+
+    SensorPipeline* pipeline = nullptr;
+    uint32_t windows = 0;
+    const BatchEncoding encodings[ENCODINGS] = {BatchEncoding::Json, BatchEncoding::MessagePack,
+                                                BatchEncoding::Binary};
+    uint64_t stateBytes = 0, statePublishes = 0, batchBytes[ENCODINGS] = {}, batchSamples = 0;
+
+private:
+    SampleBatch batch;
+    uint8_t batchPayload[SAMPLE_BATCH_PAYLOAD_SIZE];
+};
+
+static SimClock simClock;
+
+// Commands on the simulation clock.
+static bool sensorCommand(SimulatedSen5x& sensor, uint16_t command, unsigned long delay,
+                          uint16_t* words, size_t count) {
+    return simulatedCommand(simClock, sensor, command, delay, words, count);
+}
+
+// The unit tests bring their own main().
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "spsc") == 0) {
+        return spscStress(argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000000) ? 0 : 1;
+    }
+    if (argc > 1 && strcmp(argv[1], "history") == 0) {
+        return historyCheck(argc > 2 ? atof(argv[2]) : 48.0) ? 0 : 1;
+    }
+    if (argc > 1 && strcmp(argv[1], "mux") == 0) {
+        return muxSimulation(argc > 2 ? atoi(argv[2]) : 8, argc > 3 ? atof(argv[3]) : 1.0) ? 0 : 1;
+    }
+
+    // Faults injected into the responses of the simulated sensor, per read.
+    double crcRate = 0, stuckRate = 0;
+    const char* recording = argc > 2 ? argv[2] : nullptr;
+    int hoursArg = 1;
+    if (argc > 1 && strcmp(argv[1], "faults") == 0) {
+        crcRate = argc > 2 ? atof(argv[2]) : 0.01;
+        stuckRate = argc > 3 ? atof(argv[3]) : 0.001;
+        recording = nullptr;
+        hoursArg = 4;
+    }
+
+    double hours = argc > hoursArg ? atof(argv[hoursArg]) : 24.0;
+    unsigned long end = (unsigned long) (hours * 3600000.0);
+
+    ScriptedSource scripted(42);
+    RecordedSource* recorded = nullptr;
+    SampleSource* source = &scripted;
+    if (recording) {
+        recorded = new RecordedSource(recording);
+        if (!recorded->ok()) {
+            fprintf(stderr, "Can not open %s\n", recording);
+            return 1;
+        }
+        source = recorded;
+    }
+
+    SimulatedSen5x sensor(simClock, *source);
+    sensor.setFaults(7, crcRate, stuckRate);
+    SimulatedBus bus(sensor);
+    SimulatedSensor reader(bus);
+    FakeBroker broker(simClock, 2 * 3600000UL, 3 * 3600000UL + 1800000UL);
+    SensorChannel channel;
+    SimulationListener listener;
+    SensorPipeline pipeline(simClock, broker, &channel, 1, listener);
+    channel.sensor = &reader;
+    listener.pipeline = &pipeline;
+
+    Settings settings;
+    memset(&settings, 0, sizeof(settings));
+    snprintf(settings.stateTopic, sizeof(settings.stateTopic), "environment/sensirion");
+    snprintf(settings.mqttServer, sizeof(settings.mqttServer), "broker");
+    settings.mqttPort = 1883;
+    settings.mqttEnabled = 1;
+    settings.publishInterval = 10;
+    settings.heartbeat = 300;
+    settings.batchEncoding = (uint8_t) BatchEncoding::Binary;
+    pipeline.applySettings(settings);
+    pipeline.setClientId("native");
+    pipeline.setChipId(0x123456);
+
+    uint32_t loops = 0;
+    unsigned long longestLoop = 0, slept = 0;
+
+    clock_t started = clock();
+
+    sensorCommand(sensor, SEN5X_CMD_DEVICE_RESET, SEN5X_DELAY_DEVICE_RESET, nullptr, 0);
+    sensorCommand(sensor, SEN5X_CMD_START_MEASUREMENT, SEN5X_DELAY_START_MEASUREMENT, nullptr, 0);
+
+    // loop() of the single core firmware.
+    while (simClock.now() < end) {
+        unsigned long now = simClock.now();
+        loops++;
+
+        pipeline.loop(now);
+        pipeline.sample(now);
+
+        simClock.advance(LOOP_TICK_MS);
+        metrics.loop.observe((simClock.now() - now) * 1000);
+        if (simClock.now() - now > longestLoop) {
+            longestLoop = simClock.now() - now;
+        }
+
+        unsigned long idle = pipeline.idleTime(simClock.now());
+        if (idle > MAX_IDLE_MS) {
+            idle = MAX_IDLE_MS;
+        }
+        simClock.advance(idle);
+        slept += idle;
+    }
+
+    double elapsed = (double) (clock() - started) / CLOCKS_PER_SEC;
+    const RingBuffer<TimedMeasurement, SAMPLE_BUFFER_CAPACITY>& sampleBuffer = pipeline.sampleBuffer();
+    uint32_t buffered = broker.replayed() + sampleBuffer.size() + sampleBuffer.dropped();
+    uint32_t suppressed = metrics.publishesSuppressed.load();
+
+    // Every window is published, suppressed or buffered, and nothing on the
+    // way to the broker is lost or reordered.
+    const char* failure = nullptr;
+    if (sensor.samplesMissed() > 0) {
+        failure = "samples were missed";
+    } else if (broker.replayedOutOfOrder() > 0) {
+        failure = "samples were replayed out of order";
+    } else if (metrics.mqttPublishes.load() != broker.messages()) {
+        failure = "the publish count differs from the messages the broker got";
+    } else if (listener.windows != listener.statePublishes + suppressed + buffered) {
+        failure = "windows were neither published, suppressed nor buffered";
+    }
+    printf("{\"simulated_hours\":%.2f,\"wall_seconds\":%.3f,\"loops\":%u,\"longest_loop_ms\":%lu,\"awake_duty\":%.3f,"
+           "\"samples_produced\":%u,\"samples_missed\":%u,\"data_ready_polls\":%u,\"reads\":%u,"
+           "\"read_errors\":%u,\"windows\":%u,\"suppressed\":%u,\"buffered\":%u,\"replayed\":%u,"
+           "\"buffer_dropped\":%u,\"connect_attempts\":%u,\"messages\":%u,\"bytes\":%llu,"
+           "\"read_latency_ms\":[%.1f,%lu],\"crc_faults\":%u,\"stuck_faults\":%u,\"ok\":%s}\n",
+           hours, elapsed, loops, longestLoop, 1.0 - (double) slept / simClock.now(), sensor.samplesProduced(),
+           sensor.samplesMissed(), reader.polls(), reader.reads(), reader.errors(), listener.windows,
+           suppressed, buffered, broker.replayed(), sampleBuffer.dropped(),
+           broker.connectAttempts(), broker.messages(), (unsigned long long) broker.bytes(), reader.meanLatency(),
+           reader.maxLatency(), sensor.crcFaults(), sensor.stuckFaults(), failure ? "false" : "true");
+    printf("%s\n", pipeline.stateCache().front());
+    if (listener.batchSamples) {
+        printf("{\"bytes_per_sample\":{\"state\":%.1f", (double) listener.stateBytes / listener.statePublishes);
+        for (size_t i = 0; i < SimulationListener::ENCODINGS; i++) {
+            printf(",\"%s\":%.1f", batchEncodingName(listener.encodings[i]),
+                   (double) listener.batchBytes[i] / listener.batchSamples);
+        }
+        printf("}}\n");
+    }
+    if (formatMetricsJson(metrics, pipeline.publishBuffer(), pipeline.publishBufferSize())) {
+        printf("%s\n", pipeline.publishBuffer());
+    }
+#ifdef ENABLE_BENCH
+    benchReport();
+#endif
+
+    delete recorded;
+    if (failure) {
+        fprintf(stderr, "native: %s\n", failure);
+        return 1;
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,179 @@
+#include <stdio.h>
+
+#include "../measurement_aggregator.h"
+#include "../sampling_scheduler.h"
+#include "../sen5x_protocol.h"
+#include "../sen5x_reader.h"
+#include "mux_sim.h"
+#include "sample_source.h"
+#include "sen5x_sim.h"
+#include "sim_clock.h"
+
+// Time one iteration of loop() takes when there is nothing to do.
+static const unsigned long LOOP_TICK_MS = 5;
+// Longest single sleep, POWER_MAX_IDLE_MS on the device.
+static const unsigned long MAX_IDLE_MS = 1000;
+
+// The mux only forwards to the selected channel, like the firmware's I2cMux
+// it is written when the channel changes.
+class SimulatedMux {
+public:
+    SimulatedMux(SimClock& clock, SimulatedSen5x** sensors) : _clock(clock), _sensors(sensors) {}
+
+    void select(size_t channel) {
+        if (channel != _selected) {
+            _selected = channel;
+            _selects++;
+        }
+    }
+    bool command(uint16_t command, unsigned long delay, uint16_t* words, size_t count) {
+        return simulatedCommand(_clock, *_sensors[_selected], command, delay, words, count);
+    }
+    SimulatedSen5x& selected() { return *_sensors[_selected]; }
+    uint32_t selects() const { return _selects; }
+
+private:
+    SimClock& _clock;
+    SimulatedSen5x** _sensors;
+    size_t _selected = (size_t) -1;
+    uint32_t _selects = 0;
+};
+
+// A sensor behind the mux, like Sen5xSensor every transfer selects its
+// channel first.
+class MuxChannelBus : public Sen5xBus {
+public:
+    MuxChannelBus(SimulatedMux& mux, size_t channel) : _mux(mux), _channel(channel) {}
+
+    bool write(const uint8_t* data, size_t length) override {
+        _mux.select(_channel);
+        return _mux.selected().write(data, length);
+    }
+    size_t read(uint8_t* data, size_t length) override {
+        _mux.select(_channel);
+        return _mux.selected().read(data, length);
+    }
+    bool recover() override { return _mux.selected().releaseBus(); }
+
+private:
+    SimulatedMux& _mux;
+    size_t _channel;
+};
+
+bool muxSimulation(size_t sensors, double hours) {
+    SimClock clock;
+    unsigned long end = (unsigned long) (hours * 3600000.0);
+
+    if (sensors < 1 || sensors > SamplingScheduler::MAX_SENSORS) {
+        fprintf(stderr, "1 to %u sensors\n", (unsigned) SamplingScheduler::MAX_SENSORS);
+        return false;
+    }
+
+    ScriptedSource* sources[SamplingScheduler::MAX_SENSORS];
+    SimulatedSen5x* devices[SamplingScheduler::MAX_SENSORS];
+    MeasurementAggregator windows[SamplingScheduler::MAX_SENSORS];
+    uint32_t reads[SamplingScheduler::MAX_SENSORS] = {};
+    for (size_t i = 0; i < sensors; i++) {
+        sources[i] = new ScriptedSource(42 + i);
+        devices[i] = new SimulatedSen5x(clock, *sources[i]);
+    }
+    SimulatedMux mux(clock, devices);
+    SamplingScheduler sampler(10000, sensors);
+    MuxChannelBus* buses[SamplingScheduler::MAX_SENSORS];
+    Sen5xReader* readers[SamplingScheduler::MAX_SENSORS];
+    for (size_t i = 0; i < sensors; i++) {
+        buses[i] = new MuxChannelBus(mux, i);
+        readers[i] = new Sen5xReader(*buses[i]);
+    }
+
+    // setup(): reset every sensor, then start them startOffset() apart.
+    for (size_t i = 0; i < sensors; i++) {
+        mux.select(i);
+        mux.command(SEN5X_CMD_DEVICE_RESET, SEN5X_DELAY_DEVICE_RESET, nullptr, 0);
+    }
+    unsigned long started = clock.now();
+    for (size_t i = 0; i < sensors; i++) {
+        if (clock.now() - started < sampler.startOffset(i)) {
+            clock.advance(sampler.startOffset(i) - (clock.now() - started));
+        }
+        mux.select(i);
+        mux.command(SEN5X_CMD_START_MEASUREMENT, SEN5X_DELAY_START_MEASUREMENT, nullptr, 0);
+    }
+
+    uint32_t loops = 0, polls = 0, windowsClosed = 0;
+    unsigned long maxReadLatency = 0, begin = clock.now(), readStarted = 0;
+    int active = -1;
+
+    while (clock.now() < end) {
+        unsigned long now = clock.now();
+        loops++;
+
+        // sampleSensor(), one read in progress at a time.
+        if (active < 0) {
+            int sensor = sampler.nextPoll(now);
+            if (sensor >= 0) {
+                polls++;
+                readStarted = now;
+                if (readers[sensor]->begin(now)) {
+                    active = sensor;
+                }
+            }
+        }
+        if (active >= 0) {
+            SensirionMeasurement data;
+            Sen5xReadResult result = readers[active]->poll(now, data);
+            if (result == Sen5xReadResult::Sample) {
+                sampler.sampleTaken(active, readStarted);
+                windows[active].add(data);
+                reads[active]++;
+                if (readers[active]->lastLatency() > maxReadLatency) {
+                    maxReadLatency = readers[active]->lastLatency();
+                }
+            }
+            if (result != Sen5xReadResult::Pending) {
+                active = -1;
+            }
+        }
+        if (sampler.publishDue(now)) {
+            for (size_t i = 0; i < sensors; i++) {
+                if (windows[i].count() > 0) {
+                    windowsClosed++;
+                    windows[i].reset();
+                }
+            }
+        }
+
+        clock.advance(LOOP_TICK_MS);
+        unsigned long idle = sampler.idleTime(clock.now());
+        if (active >= 0 && readers[active]->idleTime(clock.now()) < idle) {
+            idle = readers[active]->idleTime(clock.now());
+        }
+        clock.advance(idle < MAX_IDLE_MS ? idle : MAX_IDLE_MS);
+    }
+
+    bool ok = true;
+    uint32_t produced = 0, missed = 0, minReads = UINT32_MAX;
+    for (size_t i = 0; i < sensors; i++) {
+        produced += devices[i]->samplesProduced();
+        missed += devices[i]->samplesMissed();
+        if (reads[i] < minReads) {
+            minReads = reads[i];
+        }
+        // Every sample but the one that may be pending at the end.
+        ok = ok && devices[i]->samplesMissed() == 0 && reads[i] + 1 >= devices[i]->samplesProduced();
+    }
+    double elapsed = (double) (clock.now() - begin);
+    printf("{\"mux\":{\"sensors\":%u,\"simulated_hours\":%.2f,\"loops\":%u,\"polls\":%u,\"samples_produced\":%u,"
+           "\"samples_missed\":%u,\"min_reads_per_sensor\":%u,\"min_rate_hz\":%.3f,\"windows\":%u,"
+           "\"mux_selects\":%u,\"max_read_latency_ms\":%lu,\"ok\":%s}}\n",
+           (unsigned) sensors, hours, loops, polls, produced, missed, minReads, minReads * 1000.0 / elapsed,
+           windowsClosed, mux.selects(), maxReadLatency, ok ? "true" : "false");
+
+    for (size_t i = 0; i < sensors; i++) {
+        delete readers[i];
+        delete buses[i];
+        delete devices[i];
+        delete sources[i];
+    }
+    return ok;
+}
@@ -0,0 +1,10 @@
+#ifndef MUX_SIM_H
+#define MUX_SIM_H
+#include <stddef.h>
+
+// Several simulated SEN5x behind a TCA9548A on one bus, read with the
+// firmware's staggered start and round robin schedule on the fake clock.
+// Prints a json summary and returns true when every sensor was read at its
+// full 1 Hz rate without losing samples.
+bool muxSimulation(size_t sensors, double hours);
+#endif
@@ -0,0 +1,76 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sample_source.h"
+
+static const float DAY_MS = 86400000.0f;
+static const float PI = 3.14159265f;
+
+SensirionMeasurement ScriptedSource::sample(unsigned long now) {
+    SensirionMeasurement data;
+    float day = sinf(2.0f * PI * (now % 86400000UL) / DAY_MS);
+    float pm = 4.0f + 2.0f * day + noise(0.3f);
+
+    // A short cooking spike every few hours.
+    if ((now / 1000) % 10800 < 120) {
+        pm += 40.0f;
+    }
+    data.setMassConcentrationPm1p0(pm * 0.7f);
+    data.setMassConcentrationPm2p5(pm);
+    data.setMassConcentrationPm4p0(pm * 1.1f);
+    data.setMassConcentrationPm10p0(pm * 1.2f);
+    data.setAmbientHumidity(45.0f - 5.0f * day + noise(0.2f));
+    data.setAmbientTemperature(21.0f + 2.0f * day + noise(0.05f));
+    if (now >= 10000) {
+        data.setVocIndex(100.0f + 20.0f * day + noise(2.0f));
+        data.setNoxIndex(1.0f);
+    }
+    return data;
+}
+
+float ScriptedSource::noise(float amplitude) {
+    // xorshift32, keeps runs reproducible.
+    _state ^= _state << 13;
+    _state ^= _state >> 17;
+    _state ^= _state << 5;
+    return amplitude * ((_state % 2001) / 1000.0f - 1.0f);
+}
+
+
+RecordedSource::RecordedSource(const char* path) {
+    _file = fopen(path, "r");
+}
+
+RecordedSource::~RecordedSource() {
+    if (_file) {
+        fclose(_file);
+    }
+}
+
+SensirionMeasurement RecordedSource::sample(unsigned long) {
+    SensirionMeasurement data;
+    char line[256];
+
+    if (!_file) {
+        return data;
+    }
+    if (!fgets(line, sizeof(line), _file)) {
+        rewind(_file);
+        if (!fgets(line, sizeof(line), _file)) {
+            return data;
+        }
+    }
+
+    char* field = line;
+    for (size_t i = 0; i < SENSOR_FIELD_COUNT && field; i++) {
+        char* end = strchr(field, ',');
+        if (end) {
+            *end = '\0';
+        }
+        if (*field && *field != '\n') {
+            data.setValue((SensorField) i, strtof(field, nullptr));
+        }
+        field = end ? end + 1 : nullptr;
+    }
+    return data;
+}
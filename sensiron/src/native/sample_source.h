@@ -0,0 +1,43 @@
+#ifndef SAMPLE_SOURCE_H
+#define SAMPLE_SOURCE_H
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../measurement.h"
+
+// Provides the values the simulated sensor reports at a point in time.
+class SampleSource {
+public:
+    virtual ~SampleSource() {}
+    virtual SensirionMeasurement sample(unsigned long now) = 0;
+};
+
+
+// Deterministic daily cycle with noise and occasional particle spikes, the
+// VOC/NOx indices report unknown during the first seconds like the sensor.
+class ScriptedSource : public SampleSource {
+public:
+    ScriptedSource(uint32_t seed) : _state(seed ? seed : 1) {}
+    SensirionMeasurement sample(unsigned long now) override;
+
+private:
+    float noise(float amplitude);
+
+    uint32_t _state;
+};
+
+
+// Replays a recording, one line per second with the comma separated values
+// pm1p0,pm2p5,pm4p0,pm10p0,humidity,temperature,vocIndex,noxIndex. Empty
+// fields are unknown, the recording wraps around at the end of the file.
+class RecordedSource : public SampleSource {
+public:
+    RecordedSource(const char* path);
+    ~RecordedSource();
+    bool ok() const { return _file != nullptr; }
+    SensirionMeasurement sample(unsigned long now) override;
+
+private:
+    FILE* _file;
+};
+#endif
@@ -0,0 +1,142 @@
+#include "sen5x_sim.h"
+
+SimulatedSen5x::SimulatedSen5x(SimClock& clock, SampleSource& source)
+    : _clock(clock), _source(source) {
+    _measuring = false;
+    _nextSample = 0;
+    _dataReady = false;
+    _produced = 0;
+    _missed = 0;
+    _readyAt = 0;
+    _responseLength = 0;
+    _random = 1;
+    _crcRate = 0;
+    _stuckRate = 0;
+    _stuck = false;
+    _crcFaults = 0;
+    _stuckFaults = 0;
+}
+
+void SimulatedSen5x::setFaults(uint32_t seed, double crcRate, double stuckRate) {
+    _random = seed ? seed : 1;
+    _crcRate = crcRate;
+    _stuckRate = stuckRate;
+}
+
+bool SimulatedSen5x::releaseBus() {
+    _stuck = false;
+    return true;
+}
+
+bool SimulatedSen5x::fault(double rate) {
+    if (rate <= 0) {
+        return false;
+    }
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return _random < rate * 4294967296.0;
+}
+
+bool SimulatedSen5x::write(const uint8_t* data, size_t length) {
+    unsigned long now = _clock.now();
+
+    if (length < 2 || now < _readyAt || _stuck) {
+        return false;
+    }
+    update();
+
+    uint16_t command = (uint16_t) (data[0] << 8 | data[1]);
+    unsigned long delay = SEN5X_DELAY_READ;
+    _responseLength = 0;
+
+    switch (command) {
+    case SEN5X_CMD_START_MEASUREMENT:
+        _measuring = true;
+        _nextSample = now + 1000;
+        delay = SEN5X_DELAY_START_MEASUREMENT;
+        break;
+    case SEN5X_CMD_STOP_MEASUREMENT:
+        _measuring = false;
+        _dataReady = false;
+        delay = SEN5X_DELAY_READ;
+        break;
+    case SEN5X_CMD_DEVICE_RESET:
+        _measuring = false;
+        _dataReady = false;
+        delay = SEN5X_DELAY_DEVICE_RESET;
+        break;
+    case SEN5X_CMD_READ_DATA_READY: {
+        uint16_t word = _dataReady ? 0x0001 : 0x0000;
+        respond(&word, 1);
+        break;
+    }
+    case SEN5X_CMD_READ_MEASURED_VALUES: {
+        uint16_t words[SEN5X_MEASUREMENT_WORDS];
+        sen5xMeasurementToWords(_sample, words);
+        respond(words, SEN5X_MEASUREMENT_WORDS);
+        _dataReady = false;
+        break;
+    }
+    default:
+        return false;
+    }
+    _readyAt = now + delay;
+    return true;
+}
+
+size_t SimulatedSen5x::read(uint8_t* data, size_t length) {
+    if (_clock.now() < _readyAt || length > _responseLength || _stuck) {
+        return 0;
+    }
+    if (fault(_stuckRate)) {
+        // Lost track of the transfer while sending a 0 bit.
+        _stuck = true;
+        _stuckFaults++;
+        _responseLength = 0;
+        return 0;
+    }
+    for (size_t i = 0; i < length; i++) {
+        data[i] = _response[i];
+    }
+    if (fault(_crcRate)) {
+        data[_random % length] ^= (uint8_t) (1 << (_random >> 8) % 8);
+        _crcFaults++;
+    }
+    _responseLength = 0;
+    return length;
+}
+
+void SimulatedSen5x::update() {
+    while (_measuring && _clock.now() >= _nextSample) {
+        if (_dataReady) {
+            _missed++;
+        }
+        _sample = _source.sample(_nextSample);
+        _dataReady = true;
+        _produced++;
+        _nextSample += 1000;
+    }
+}
+
+void SimulatedSen5x::respond(const uint16_t* words, size_t count) {
+    _responseLength = sen5xEncodeWords(words, count, _response);
+}
+
+bool simulatedCommand(SimClock& clock, SimulatedSen5x& sensor, uint16_t command, unsigned long delay,
+                      uint16_t* words, size_t count) {
+    uint8_t buffer[3 * SEN5X_MEASUREMENT_WORDS];
+    uint8_t frame[2] = {(uint8_t) (command >> 8), (uint8_t) (command & 0xFF)};
+
+    if (!sensor.write(frame, sizeof(frame))) {
+        return false;
+    }
+    clock.advance(delay);
+    if (count == 0) {
+        return true;
+    }
+    if (sensor.read(buffer, 3 * count) != 3 * count) {
+        return false;
+    }
+    return sen5xDecodeWords(buffer, count, words);
+}
@@ -0,0 +1,132 @@
+#ifndef SEN5X_SIM_H
+#define SEN5X_SIM_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../pipeline_io.h"
+#include "../sen5x_protocol.h"
+#include "../sen5x_reader.h"
+#include "sample_source.h"
+#include "sim_clock.h"
+
+// Simulated SEN5x on the I2C bus. Implements the commands the firmware
+// uses with the real framing, CRCs and execution times: a read before the
+// command finished executing is NACKed like on the real sensor. While
+// measuring a new sample is taken from the source every second.
+//
+// Faults can be injected: a flipped bit in a response, which fails its CRC,
+// and a read that leaves SDA held low so every transfer fails until the bus
+// is recovered.
+class SimulatedSen5x {
+public:
+    SimulatedSen5x(SimClock& clock, SampleSource& source);
+
+    // Probabilities per response read, 0 to 1.
+    void setFaults(uint32_t seed, double crcRate, double stuckRate);
+    // The SCL clocks of a bus recovery, true once SDA is released.
+    bool releaseBus();
+
+    // Bus side, false / 0 is a NACK.
+    bool write(const uint8_t* data, size_t length);
+    size_t read(uint8_t* data, size_t length);
+
+    bool measuring() const { return _measuring; }
+    uint32_t samplesProduced() const { return _produced; }
+    uint32_t samplesMissed() const { return _missed; }
+    uint32_t crcFaults() const { return _crcFaults; }
+    uint32_t stuckFaults() const { return _stuckFaults; }
+
+private:
+    void update();
+    bool fault(double rate);
+    void respond(const uint16_t* words, size_t count);
+
+    SimClock& _clock;
+    SampleSource& _source;
+    bool _measuring;
+    unsigned long _nextSample;
+    bool _dataReady;
+    SensirionMeasurement _sample;
+    uint32_t _produced;
+    uint32_t _missed;
+
+    unsigned long _readyAt;
+    uint8_t _response[3 * SEN5X_MEASUREMENT_WORDS];
+    size_t _responseLength;
+
+    uint32_t _random;
+    double _crcRate;
+    double _stuckRate;
+    bool _stuck;
+    uint32_t _crcFaults;
+    uint32_t _stuckFaults;
+};
+
+// The simulated sensor as the bus of a Sen5xReader.
+class SimulatedBus : public Sen5xBus {
+public:
+    SimulatedBus(SimulatedSen5x& sensor) : _sensor(sensor) {}
+
+    bool write(const uint8_t* data, size_t length) override { return _sensor.write(data, length); }
+    size_t read(uint8_t* data, size_t length) override { return _sensor.read(data, length); }
+    bool recover() override { return _sensor.releaseBus(); }
+
+private:
+    SimulatedSen5x& _sensor;
+};
+
+// The simulated sensor as the pipeline reads it, through a Sen5xReader like
+// Sen5xSensor does on the device. Counts the reads for the report.
+class SimulatedSensor : public Sensor {
+public:
+    SimulatedSensor(Sen5xBus& bus) : _reader(bus) {}
+
+    bool beginRead(unsigned long now) override {
+        _polls++;
+        bool ok = _reader.begin(now);
+        if (!ok) {
+            _errors++;
+        }
+        return ok;
+    }
+    Sen5xReadResult pollRead(unsigned long now, SensirionMeasurement& data) override {
+        Sen5xReadResult result = _reader.poll(now, data);
+        if (result == Sen5xReadResult::Sample) {
+            _reads++;
+            _latency += _reader.lastLatency();
+            if (_reader.lastLatency() > _maxLatency) {
+                _maxLatency = _reader.lastLatency();
+            }
+        } else if (result == Sen5xReadResult::Error) {
+            _errors++;
+        }
+        return result;
+    }
+    bool reading() const override { return _reader.busy(); }
+    unsigned long readIdleTime(unsigned long now) const override { return _reader.idleTime(now); }
+
+    const char* serialNumber() const override { return "SIMULATED"; }
+    const char* hwVersion() const override { return "1.0"; }
+    const char* swVersion() const override { return "2.0"; }
+
+    uint32_t polls() const { return _polls; }
+    uint32_t reads() const { return _reads; }
+    uint32_t errors() const { return _errors; }
+    // Milliseconds from the data-ready check to the sample.
+    double meanLatency() const { return _reads ? (double) _latency / _reads : 0.0; }
+    unsigned long maxLatency() const { return _maxLatency; }
+
+private:
+    Sen5xReader _reader;
+    uint32_t _polls = 0;
+    uint32_t _reads = 0;
+    uint32_t _errors = 0;
+    uint64_t _latency = 0;
+    unsigned long _maxLatency = 0;
+};
+
+// Sends a command and reads count words back after the execution time,
+// blocking on the fake clock like the Sensirion driver does on the device.
+bool simulatedCommand(SimClock& clock, SimulatedSen5x& sensor, uint16_t command, unsigned long delay,
+                      uint16_t* words, size_t count);
+#endif
@@ -0,0 +1,27 @@
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+#include <stdint.h>
+
+#include "../pipeline_io.h"
+
+// Fake millis() of the native build, time only moves when advanced.
+class SimClock : public Clock {
+public:
+    unsigned long now() const { return _now; }
+    void advance(unsigned long ms) { _now += ms; }
+
+    unsigned long millis() override { return _now; }
+    uint32_t micros() override { return (uint32_t) (_now * 1000); }
+    // xorshift32, the same sequence on every run.
+    long random() override {
+        _random ^= _random << 13;
+        _random ^= _random >> 17;
+        _random ^= _random << 5;
+        return (long) (_random % 0x7fffffff);
+    }
+
+private:
+    unsigned long _now = 0;
+    uint32_t _random = 1;
+};
+#endif
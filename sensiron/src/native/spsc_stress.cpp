@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <thread>
+
+#include "../spsc_queue.h"
+#include "spsc_stress.h"
+
+// Large enough that a torn copy shows up as a mismatch between the words.
+struct StressItem {
+    uint32_t sequence;
+    uint32_t words[15];
+};
+
+static SpscQueue<StressItem, 8> queue;
+
+static StressItem makeItem(uint32_t sequence) {
+    StressItem item;
+    item.sequence = sequence;
+    for (uint32_t i = 0; i < 15; i++) {
+        item.words[i] = sequence * 2654435761U + i;
+    }
+    return item;
+}
+
+static bool intact(const StressItem& item) {
+    for (uint32_t i = 0; i < 15; i++) {
+        if (item.words[i] != item.sequence * 2654435761U + i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Consumes until the item with sequence last arrived, returns the number of
+// items received or 0 on an error.
+static uint32_t consume(uint32_t last) {
+    StressItem item;
+    uint32_t received = 0;
+    int64_t previous = -1;
+
+    for (;;) {
+        if (!queue.pop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        received++;
+        if (!intact(item) || (int64_t) item.sequence <= previous) {
+            fprintf(stderr, "spsc: item %u out of order or torn after %lld\n", item.sequence, (long long) previous);
+            return 0;
+        }
+        previous = item.sequence;
+        if (item.sequence == last) {
+            return received;
+        }
+    }
+}
+
+bool spscStress(uint32_t items) {
+    // Lossless: the producer retries until there is room.
+    std::thread producer([items] {
+        for (uint32_t i = 0; i < items; i++) {
+            StressItem item = makeItem(i);
+            while (!queue.push(item)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint32_t received = consume(items - 1);
+    producer.join();
+    if (received != items) {
+        return false;
+    }
+    // The retries above were counted as drops.
+    uint32_t refused = queue.dropped();
+    uint32_t retries = 0;
+
+    // Lossy: like the sampling task the producer never waits. The last item
+    // is pushed until it fits so the consumer knows when to stop.
+    std::thread lossy([items, &retries] {
+        for (uint32_t i = 0; i + 1 < items; i++) {
+            queue.push(makeItem(i));
+        }
+        while (!queue.push(makeItem(items - 1))) {
+            retries++;
+            std::this_thread::yield();
+        }
+    });
+    uint32_t lossyReceived = consume(items - 1);
+    lossy.join();
+    uint32_t dropped = queue.dropped() - refused - retries;
+    bool ok = lossyReceived > 0 && lossyReceived + dropped == items && queue.empty();
+
+    printf("{\"spsc\":{\"items\":%u,\"lossless_received\":%u,\"lossy_received\":%u,\"lossy_dropped\":%u,\"ok\":%s}}\n",
+           items, received, lossyReceived, dropped, ok ? "true" : "false");
+    return ok;
+}
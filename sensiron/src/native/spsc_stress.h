@@ -0,0 +1,10 @@
+#ifndef SPSC_STRESS_H
+#define SPSC_STRESS_H
+#include <stdint.h>
+
+// Runs a producer and a consumer thread over a SpscQueue and checks that
+// every item arrives once, in order and not torn. A second pass with a
+// producer that never waits checks the drop count. Prints a json summary,
+// returns false on the first mismatch.
+bool spscStress(uint32_t items);
+#endif
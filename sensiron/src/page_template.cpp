@@ -0,0 +1,89 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include "page_template.h"
+
+// Longest placeholder name.
+static const size_t NAME_SIZE = 32;
+
+ChunkWriter::ChunkWriter(uint8_t* buf, size_t size)
+    : _buf(buf), _size(size), _skip(0), _length(0), _overflow(0) {}
+
+void ChunkWriter::put(char c) {
+    if (_skip > 0) {
+        _skip--;
+    } else if (_length < _size) {
+        _buf[_length++] = (uint8_t) c;
+    } else {
+        _overflow++;
+    }
+}
+
+void ChunkWriter::print(const char* text) {
+    while (*text) {
+        put(*text++);
+    }
+}
+
+void ChunkWriter::printEscaped(const char* text) {
+    for (; *text; text++) {
+        switch (*text) {
+        case '&': print("&amp;"); break;
+        case '<': print("&lt;"); break;
+        case '>': print("&gt;"); break;
+        case '"': print("&quot;"); break;
+        case '\'': print("&#39;"); break;
+        default: put(*text);
+        }
+    }
+}
+
+void ChunkWriter::printf(const char* format, ...) {
+    char line[128];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    print(line);
+}
+
+void renderTemplate(const char* page, TemplateCursor& cursor, ChunkWriter& out, TemplateExpander expand,
+                    void* context) {
+    char name[NAME_SIZE];
+    char c;
+
+    while (!out.full() && (c = (char) pgm_read_byte(page + cursor.offset)) != 0) {
+        if (c != '%') {
+            out.put(c);
+            cursor.offset++;
+            continue;
+        }
+        size_t end = cursor.offset + 1;
+        size_t length = 0;
+        while ((c = (char) pgm_read_byte(page + end)) != 0 && c != '%') {
+            if (length < NAME_SIZE) {
+                name[length++] = c;
+            }
+            end++;
+        }
+        if (c == 0) {
+            break; // Unterminated placeholder.
+        }
+        if (length == 0) {
+            out.put('%');
+        } else {
+            // Expanded again from the start, the part sent with the previous
+            // chunk is skipped.
+            size_t before = out.length();
+            out.skip(cursor.expanded);
+            expand(context, name, length, out);
+            out.skip(0);
+            if (out.overflowed()) {
+                cursor.expanded += out.length() - before;
+                return;
+            }
+            cursor.expanded = 0;
+        }
+        cursor.offset = end + 1;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef PAGE_TEMPLATE_H
+#define PAGE_TEMPLATE_H
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t*) (address))
+#endif
+
+// Writes one chunk of a rendered page to buf. The memory used does not
+// depend on the size of the page, what does not fit is counted and left for
+// the next chunk, see TemplateCursor.
+class ChunkWriter {
+public:
+    ChunkWriter(uint8_t* buf, size_t size);
+
+    void put(char c);
+    void print(const char* text);
+    // For values in attributes and text, escapes & < > " and '.
+    void printEscaped(const char* text);
+    // Formatted output of up to 127 characters.
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+    // The next count characters are dropped, they went out with the
+    // previous chunk.
+    void skip(size_t count) { _skip = count; }
+
+    // True once buf is full, rendering can stop.
+    bool full() const { return _length == _size; }
+    // True if characters were dropped because buf was full.
+    bool overflowed() const { return _overflow > 0; }
+    size_t length() const { return _length; }
+
+private:
+    uint8_t* _buf;
+    size_t _size;
+    size_t _skip;
+    size_t _length;
+    size_t _overflow;
+};
+
+// Where the previous chunk of a page stopped, kept by the response between
+// its chunks.
+struct TemplateCursor {
+    // Offset in the template of the next text or placeholder.
+    size_t offset = 0;
+    // Characters of the expansion of the placeholder at offset that were
+    // sent already. The expansion must come out the same on every chunk.
+    size_t expanded = 0;
+};
+
+// Writes the expansion of the placeholder name (not terminated) to out.
+typedef void (*TemplateExpander)(void* context, const char* name, size_t length, ChunkWriter& out);
+
+// Renders the next chunk of a PROGMEM template, starting where cursor
+// stopped. %NAME% is replaced through expand and %% is a literal %. A chunk
+// shorter than the buffer is the last one.
+void renderTemplate(const char* page, TemplateCursor& cursor, ChunkWriter& out, TemplateExpander expand,
+                    void* context);
+
+#endif
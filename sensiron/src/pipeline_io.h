@@ -0,0 +1,60 @@
+#ifndef PIPELINE_IO_H
+#define PIPELINE_IO_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "measurement.h"
+#include "sen5x_reader.h"
+
+// What the sampling and publish pipeline needs from the platform. The
+// firmware implements these over the Arduino core, PubSubClient and the
+// SEN5x driver (arduino_io.h), the native simulation over a fake clock, a
+// fake broker and the simulated sensor.
+
+class Clock {
+public:
+    virtual ~Clock() {}
+
+    virtual unsigned long millis() = 0;
+    virtual uint32_t micros() = 0;
+    // 0 to 0x7ffffffe, a different sequence on every device.
+    virtual long random() = 0;
+};
+
+// The calls of PubSubClient the pipeline makes.
+class MqttClient {
+public:
+    virtual ~MqttClient() {}
+
+    // host is kept, it must stay valid while connecting.
+    virtual void setServer(const char* host, uint16_t port) = 0;
+    virtual bool connect(const char* clientId) = 0;
+    virtual bool connected() = 0;
+    // Keeps the session alive and delivers the messages of the subscriptions.
+    virtual bool loop() = 0;
+    virtual void disconnect() = 0;
+    virtual bool publish(const char* topic, const uint8_t* payload, size_t length, bool retained) = 0;
+    virtual bool subscribe(const char* topic) = 0;
+    virtual bool unsubscribe(const char* topic) = 0;
+    // Reason of the last failed connect, PubSubClient's state().
+    virtual int state() = 0;
+};
+
+// One SEN5x as the pipeline reads it, see Sen5xSensor.
+class Sensor {
+public:
+    virtual ~Sensor() {}
+
+    // Starts reading a sample, pollRead() until it is no longer Pending.
+    virtual bool beginRead(unsigned long now) = 0;
+    virtual Sen5xReadResult pollRead(unsigned long now, SensirionMeasurement& data) = 0;
+    virtual bool reading() const = 0;
+    // Milliseconds until pollRead() has something to do.
+    virtual unsigned long readIdleTime(unsigned long now) const = 0;
+
+    // Device info for the discovery, empty when it could not be read.
+    virtual const char* serialNumber() const = 0;
+    virtual const char* hwVersion() const = 0;
+    virtual const char* swVersion() const = 0;
+};
+#endif
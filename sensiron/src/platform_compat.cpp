@@ -0,0 +1,39 @@
+#include "platform_compat.h"
+
+#ifdef ESP32
+
+uint32_t platformChipId() {
+    uint64_t mac = ESP.getEfuseMac();
+    uint32_t id = 0;
+
+    // The last three bytes of the MAC, most significant first.
+    for (int i = 0; i < 24; i += 8) {
+        id |= ((mac >> (40 - i)) & 0xFF) << i;
+    }
+    return id;
+}
+
+uint32_t platformMaxFreeBlock() {
+    return ESP.getMaxAllocHeap();
+}
+
+uint32_t platformFreeStack() {
+    // The ESP-IDF port counts the stack in bytes.
+    return uxTaskGetStackHighWaterMark(nullptr);
+}
+
+#else
+
+uint32_t platformChipId() {
+    return ESP.getChipId();
+}
+
+uint32_t platformMaxFreeBlock() {
+    return ESP.getMaxFreeBlockSize();
+}
+
+uint32_t platformFreeStack() {
+    return ESP.getFreeContStack();
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef PLATFORM_COMPAT_H
+#define PLATFORM_COMPAT_H
+#include <Arduino.h>
+
+// The few chip specific calls that differ between the ESP8266 and the ESP32
+// cores.
+
+// 24 bit chip id, on the ESP32 taken from the factory MAC like the ESP8266
+// does.
+uint32_t platformChipId();
+// Largest block malloc() can return.
+uint32_t platformMaxFreeBlock();
+// Low water mark of the calling task's stack (the loop stack on the
+// ESP8266), in bytes.
+uint32_t platformFreeStack();
+
+#endif
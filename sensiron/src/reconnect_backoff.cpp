@@ -0,0 +1,22 @@
+#include "reconnect_backoff.h"
+
+ReconnectBackoff::ReconnectBackoff(unsigned long minDelay, unsigned long maxDelay) {
+    _minDelay = minDelay;
+    _maxDelay = maxDelay;
+    reset();
+}
+
+void ReconnectBackoff::reset() {
+    _delay = _minDelay;
+}
+
+unsigned long ReconnectBackoff::nextDelay(unsigned long jitter) {
+    unsigned long current = _delay;
+
+    if (_delay < _maxDelay / 2) {
+        _delay *= 2;
+    } else {
+        _delay = _maxDelay;
+    }
+    return current / 2 + jitter % (current / 2 + 1);
+}
@@ -0,0 +1,18 @@
+#ifndef RECONNECT_BACKOFF_H
+#define RECONNECT_BACKOFF_H
+
+// Delay between reconnect attempts, doubling on every failure up to maxDelay.
+// The jitter spreads a fleet of sensors out when the broker comes back, the
+// returned delay is in the range [delay/2, delay].
+class ReconnectBackoff {
+public:
+    ReconnectBackoff(unsigned long minDelay, unsigned long maxDelay);
+    void reset();
+    unsigned long nextDelay(unsigned long jitter);
+
+private:
+    unsigned long _minDelay;
+    unsigned long _maxDelay;
+    unsigned long _delay;
+};
+#endif
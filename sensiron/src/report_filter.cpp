@@ -0,0 +1,46 @@
+#include <math.h>
+#include "report_filter.h"
+
+ReportFilter::ReportFilter(unsigned long heartbeat) {
+    _heartbeat = heartbeat;
+    _hasLast = false;
+    _lastTime = 0;
+}
+
+void ReportFilter::setDeadband(SensorField field, const Deadband& deadband) {
+    _deadbands[(size_t) field] = deadband;
+}
+
+bool ReportFilter::shouldPublish(const SensirionMeasurement& data, unsigned long now) const {
+    if (!_hasLast || now - _lastTime >= _heartbeat) {
+        return true;
+    }
+    for (size_t i = 0; i < SENSOR_FIELD_COUNT; i++) {
+        if (exceeded((SensorField) i, data)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ReportFilter::published(const SensirionMeasurement& data, unsigned long now) {
+    _last = data;
+    _hasLast = true;
+    _lastTime = now;
+}
+
+bool ReportFilter::exceeded(SensorField field, const SensirionMeasurement& data) const {
+    const Deadband& deadband = _deadbands[(size_t) field];
+
+    // Going from or to unknown is always a change worth reporting.
+    if (data.known(field) != _last.known(field)) {
+        return true;
+    }
+    if (!data.known(field) || data.raw(field) == _last.raw(field)) {
+        return false;
+    }
+
+    float last = _last.value(field);
+    float limit = deadband.relative ? fabsf(last) * deadband.threshold / 100.0f : deadband.threshold;
+    return fabsf(data.value(field) - last) > limit;
+}
@@ -0,0 +1,38 @@
+#ifndef REPORT_FILTER_H
+#define REPORT_FILTER_H
+#include <stdint.h>
+
+#include "measurement.h"
+
+// Change a field has to exceed before it is reported again. A relative
+// threshold is in percent of the last reported value, 0 reports any change.
+struct Deadband {
+    float threshold = 0.0f;
+    bool relative = false;
+};
+
+// Report by exception: a measurement is only published when a field moved
+// past its deadband since the last published one, or when the heartbeat
+// interval expired so consumers can tell the sensor is still alive.
+class ReportFilter {
+public:
+    ReportFilter(unsigned long heartbeat);
+
+    void setDeadband(SensorField field, const Deadband& deadband);
+    const Deadband& deadband(SensorField field) const { return _deadbands[(size_t) field]; }
+    void setHeartbeat(unsigned long heartbeat) { _heartbeat = heartbeat; }
+    unsigned long heartbeat() const { return _heartbeat; }
+
+    bool shouldPublish(const SensirionMeasurement& data, unsigned long now) const;
+    void published(const SensirionMeasurement& data, unsigned long now);
+
+private:
+    bool exceeded(SensorField field, const SensirionMeasurement& data) const;
+
+    Deadband _deadbands[SENSOR_FIELD_COUNT];
+    SensirionMeasurement _last;
+    bool _hasLast;
+    unsigned long _lastTime;
+    unsigned long _heartbeat;
+};
+#endif
@@ -0,0 +1,64 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Double buffered, preformatted response body. A new version is rendered
+// into the back buffer and published with commit(), requests copy the front
+// buffer with copy() instead of formatting anything. The generation number
+// identifies the version and makes up the ETag.
+template <size_t Size>
+class ResponseCache {
+public:
+    ResponseCache(const char* initial) : _front(0), _generation(0) {
+        strncpy(_buffers[0], initial, Size - 1);
+        _buffers[0][Size - 1] = '\0';
+        _lengths[0] = strlen(_buffers[0]);
+    }
+
+    // Start the generation numbers from seed, so ETags of a previous boot
+    // are not mistaken for the current content.
+    void seed(uint32_t seed) { _generation = seed; }
+
+    char* back() { return _buffers[1 - _front]; }
+    size_t capacity() const { return Size; }
+
+    // The generation changes after the swap, so a buffer is only rendered
+    // into again once the generation moved past the one it was read with.
+    void commit(size_t length) {
+        _lengths[1 - _front] = length;
+        _front = 1 - _front;
+        _generation++;
+    }
+
+    // For the writer's side, a reader in another task uses copy().
+    const char* front() const { return _buffers[_front]; }
+    size_t length() const { return _lengths[_front]; }
+    uint32_t generation() const { return _generation; }
+
+    // Copies the front buffer and its generation, consistent even when the
+    // writer committed meanwhile. A response sent straight from the buffer
+    // could be overwritten by the second commit while a slow client is still
+    // receiving it. Returns the length, 0 if it does not fit in buf.
+    size_t copy(char* buf, size_t size, uint32_t& generation) const {
+        size_t length;
+        do {
+            generation = _generation;
+            uint8_t front = _front;
+            length = _lengths[front];
+            if (length > size) {
+                return 0;
+            }
+            memcpy(buf, _buffers[front], length);
+        } while (generation != _generation);
+        return length;
+    }
+
+private:
+    char _buffers[2][Size];
+    size_t _lengths[2];
+    volatile uint8_t _front;
+    volatile uint32_t _generation;
+};
+#endif
@@ -0,0 +1,107 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+#include <stddef.h>
+#include <stdint.h>
+
+enum class DropPolicy {
+    // Overwrite the oldest entry, the buffer holds the latest Capacity samples.
+    DropOldest,
+    // Throw away every other entry and halve the rate new entries are taken
+    // in, the buffer keeps covering the whole outage at a lower resolution.
+    Decimate
+};
+
+// Fixed capacity FIFO, all storage is inline so there are no allocations.
+// Kept free of Arduino dependencies so it can be built on the host.
+template <typename T, size_t Capacity>
+class RingBuffer {
+public:
+    RingBuffer(DropPolicy policy = DropPolicy::DropOldest)
+        : _policy(policy), _head(0), _count(0), _stride(1), _skip(0), _dropped(0) {}
+
+    // Returns true if an entry was displaced, it is copied to evicted when
+    // given. Entries skipped by decimation are not reported as evicted.
+    bool push(const T& item, T* evicted = nullptr) {
+        bool displaced = false;
+
+        if (_skip > 0) {
+            _skip--;
+            _dropped++;
+            return false;
+        }
+        if (_count == Capacity) {
+            if (_policy == DropPolicy::Decimate) {
+                decimate();
+            } else {
+                if (evicted) {
+                    *evicted = _items[_head];
+                }
+                _head = (_head + 1) % Capacity;
+                _count--;
+                _dropped++;
+                displaced = true;
+            }
+        }
+        _items[(_head + _count) % Capacity] = item;
+        _count++;
+        _skip = _stride - 1;
+        return displaced;
+    }
+
+    // Oldest entry first, index must be below size().
+    const T& peek(size_t index = 0) const {
+        return _items[(_head + index) % Capacity];
+    }
+
+    bool pop(T* item = nullptr) {
+        if (_count == 0) {
+            return false;
+        }
+        if (item) {
+            *item = _items[_head];
+        }
+        _head = (_head + 1) % Capacity;
+        _count--;
+        if (_count == 0) {
+            _stride = 1;
+            _skip = 0;
+        }
+        return true;
+    }
+
+    void clear() {
+        _head = 0;
+        _count = 0;
+        _stride = 1;
+        _skip = 0;
+    }
+
+    void setPolicy(DropPolicy policy) { _policy = policy; }
+    size_t size() const { return _count; }
+    size_t capacity() const { return Capacity; }
+    bool empty() const { return _count == 0; }
+    bool full() const { return _count == Capacity; }
+    // Number of entries lost to the drop policy since boot.
+    uint32_t dropped() const { return _dropped; }
+
+private:
+    void decimate() {
+        // Compacts in place, the write position never passes the read one.
+        size_t kept = 0;
+        for (size_t i = 0; i < _count; i += 2) {
+            _items[(_head + kept++) % Capacity] = _items[(_head + i) % Capacity];
+        }
+        _dropped += _count - kept;
+        _count = kept;
+        _stride *= 2;
+    }
+
+    T _items[Capacity];
+    DropPolicy _policy;
+    size_t _head;
+    size_t _count;
+    size_t _stride;
+    size_t _skip;
+    uint32_t _dropped;
+};
+#endif
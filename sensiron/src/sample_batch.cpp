@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <string.h>
+#include "sample_batch.h"
+#include "sensor_fields.h"
+
+static const uint8_t BINARY_MAGIC[2] = {'S', 'B'};
+static const uint8_t BATCH_VERSION = 1;
+static_assert(SENSOR_DESCRIPTOR_COUNT <= 8, "the binary presence mask is one byte");
+
+static const char* const ENCODING_NAMES[] = {"json", "msgpack", "binary"};
+
+const char* batchEncodingName(BatchEncoding encoding) {
+    return ENCODING_NAMES[(size_t) encoding];
+}
+
+bool parseBatchEncoding(const char* name, BatchEncoding& encoding) {
+    for (size_t i = 0; i < sizeof(ENCODING_NAMES) / sizeof(ENCODING_NAMES[0]); i++) {
+        if (strcmp(name, ENCODING_NAMES[i]) == 0) {
+            encoding = (BatchEncoding) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+SampleBatch::SampleBatch() : _count(0) {}
+
+void SampleBatch::clear() {
+    _count = 0;
+}
+
+bool SampleBatch::add(uint32_t timestamp, const SensirionMeasurement& data) {
+    if (_count == SAMPLE_BATCH_CAPACITY) {
+        return false;
+    }
+    _timestamps[_count] = timestamp;
+    _samples[_count] = data;
+    _count++;
+    return true;
+}
+
+size_t SampleBatch::encode(BatchEncoding encoding, uint32_t now, uint8_t* buf, size_t size) const {
+    switch (encoding) {
+    case BatchEncoding::Json: return encodeJson(now, (char*) buf, size);
+    case BatchEncoding::MessagePack: return encodeMessagePack(now, buf, size);
+    case BatchEncoding::Binary: return encodeBinary(now, buf, size);
+    }
+    return 0;
+}
+
+// Seconds between sample index and the one before it, 0 for the first.
+static uint32_t delta(const uint32_t* timestamps, size_t index) {
+    return index == 0 ? 0 : timestamps[index] - timestamps[index - 1];
+}
+
+// Appends formatted text to buf, returns false if it does not fit.
+static bool append(char* buf, size_t size, size_t& pos, const char* format, long value = 0) {
+    int n = snprintf(buf + pos, size - pos, format, value);
+    if (n < 0 || (size_t) n >= size - pos) {
+        return false;
+    }
+    pos += n;
+    return true;
+}
+
+static bool appendText(char* buf, size_t size, size_t& pos, const char* format, const char* text) {
+    int n = snprintf(buf + pos, size - pos, format, text);
+    if (n < 0 || (size_t) n >= size - pos) {
+        return false;
+    }
+    pos += n;
+    return true;
+}
+
+size_t SampleBatch::encodeJson(uint32_t now, char* buf, size_t size) const {
+    size_t pos = 0;
+    bool ok = append(buf, size, pos, "{\"v\":%ld,", BATCH_VERSION) &&
+              append(buf, size, pos, "\"age\":%ld,\"fields\":[", _count ? (long) (now - _timestamps[0]) : 0);
+
+    for (size_t i = 0; ok && i < SENSOR_DESCRIPTOR_COUNT; i++) {
+        ok = appendText(buf, size, pos, i ? ",\"%s\"" : "\"%s\"", SENSOR_DESCRIPTORS[i].key);
+    }
+    ok = ok && appendText(buf, size, pos, "%s", "],\"scale\":[");
+    for (size_t i = 0; ok && i < SENSOR_DESCRIPTOR_COUNT; i++) {
+        ok = append(buf, size, pos, i ? ",%ld" : "%ld", SensirionMeasurement::scale(SENSOR_DESCRIPTORS[i].field));
+    }
+    ok = ok && appendText(buf, size, pos, "%s", "],\"dt\":[");
+    for (size_t i = 0; ok && i < _count; i++) {
+        ok = append(buf, size, pos, i ? ",%ld" : "%ld", (long) delta(_timestamps, i));
+    }
+    ok = ok && appendText(buf, size, pos, "%s", "],\"d\":[");
+    for (size_t i = 0; ok && i < _count; i++) {
+        ok = appendText(buf, size, pos, "%s", i ? ",[" : "[");
+        for (size_t j = 0; ok && j < SENSOR_DESCRIPTOR_COUNT; j++) {
+            SensorField field = SENSOR_DESCRIPTORS[j].field;
+            const char* separator = j ? "," : "";
+            if (_samples[i].known(field)) {
+                ok = appendText(buf, size, pos, "%s", separator) &&
+                     append(buf, size, pos, "%ld", (long) _samples[i].raw(field));
+            } else {
+                ok = appendText(buf, size, pos, "%snull", separator);
+            }
+        }
+        ok = ok && appendText(buf, size, pos, "%s", "]");
+    }
+    ok = ok && appendText(buf, size, pos, "%s", "]}");
+    return ok ? pos : 0;
+}
+
+// Bounds checked byte output for the binary encodings.
+class ByteWriter {
+public:
+    ByteWriter(uint8_t* buf, size_t size) : _buf(buf), _size(size), _pos(0), _ok(true) {}
+
+    void byte(uint8_t value) {
+        if (_pos < _size) {
+            _buf[_pos++] = value;
+        } else {
+            _ok = false;
+        }
+    }
+
+    // Big endian, as used by MessagePack.
+    void bigEndian(uint32_t value, int bytes) {
+        while (bytes-- > 0) {
+            byte((uint8_t) (value >> (8 * bytes)));
+        }
+    }
+
+    // LEB128, 7 bits per byte with the high bit set on all but the last.
+    void varint(uint32_t value) {
+        while (value >= 0x80) {
+            byte((uint8_t) (value | 0x80));
+            value >>= 7;
+        }
+        byte((uint8_t) value);
+    }
+
+    // Small magnitudes of either sign encode to one byte.
+    void zigzag(int32_t value) {
+        varint(((uint32_t) value << 1) ^ (uint32_t) (value >> 31));
+    }
+
+    size_t length() const { return _ok ? _pos : 0; }
+
+private:
+    uint8_t* _buf;
+    size_t _size;
+    size_t _pos;
+    bool _ok;
+};
+
+// MessagePack in the smallest representation for each value.
+static void packInt(ByteWriter& out, int32_t value) {
+    if (value >= 0) {
+        if (value < 0x80) {
+            out.byte((uint8_t) value);
+        } else if (value <= 0xFF) {
+            out.byte(0xcc);
+            out.bigEndian(value, 1);
+        } else if (value <= 0xFFFF) {
+            out.byte(0xcd);
+            out.bigEndian(value, 2);
+        } else {
+            out.byte(0xce);
+            out.bigEndian(value, 4);
+        }
+    } else if (value >= -32) {
+        out.byte((uint8_t) value);
+    } else if (value >= -128) {
+        out.byte(0xd0);
+        out.bigEndian((uint32_t) value, 1);
+    } else if (value >= -32768) {
+        out.byte(0xd1);
+        out.bigEndian((uint32_t) value, 2);
+    } else {
+        out.byte(0xd2);
+        out.bigEndian((uint32_t) value, 4);
+    }
+}
+
+static void packString(ByteWriter& out, const char* text) {
+    size_t length = strlen(text);
+
+    out.byte(0xa0 | (uint8_t) length); // Keys are all shorter than 32.
+    for (size_t i = 0; i < length; i++) {
+        out.byte((uint8_t) text[i]);
+    }
+}
+
+static void packArray(ByteWriter& out, size_t length) {
+    if (length < 16) {
+        out.byte(0x90 | (uint8_t) length);
+    } else {
+        out.byte(0xdc);
+        out.bigEndian(length, 2);
+    }
+}
+
+size_t SampleBatch::encodeMessagePack(uint32_t now, uint8_t* buf, size_t size) const {
+    ByteWriter out(buf, size);
+
+    // Same document as the json encoding.
+    out.byte(0x86);
+    packString(out, "v");
+    packInt(out, BATCH_VERSION);
+    packString(out, "age");
+    packInt(out, _count ? (int32_t) (now - _timestamps[0]) : 0);
+    packString(out, "fields");
+    packArray(out, SENSOR_DESCRIPTOR_COUNT);
+    for (const SensorDescriptor& sensor : SENSOR_DESCRIPTORS) {
+        packString(out, sensor.key);
+    }
+    packString(out, "scale");
+    packArray(out, SENSOR_DESCRIPTOR_COUNT);
+    for (const SensorDescriptor& sensor : SENSOR_DESCRIPTORS) {
+        packInt(out, SensirionMeasurement::scale(sensor.field));
+    }
+    packString(out, "dt");
+    packArray(out, _count);
+    for (size_t i = 0; i < _count; i++) {
+        packInt(out, (int32_t) delta(_timestamps, i));
+    }
+    packString(out, "d");
+    packArray(out, _count);
+    for (size_t i = 0; i < _count; i++) {
+        packArray(out, SENSOR_DESCRIPTOR_COUNT);
+        for (const SensorDescriptor& sensor : SENSOR_DESCRIPTORS) {
+            if (_samples[i].known(sensor.field)) {
+                packInt(out, _samples[i].raw(sensor.field));
+            } else {
+                out.byte(0xc0);
+            }
+        }
+    }
+    return out.length();
+}
+
+size_t SampleBatch::encodeBinary(uint32_t now, uint8_t* buf, size_t size) const {
+    ByteWriter out(buf, size);
+    int32_t previous[SENSOR_DESCRIPTOR_COUNT] = {};
+
+    out.byte(BINARY_MAGIC[0]);
+    out.byte(BINARY_MAGIC[1]);
+    out.byte(BATCH_VERSION);
+    out.byte(SENSOR_DESCRIPTOR_COUNT);
+    out.byte((uint8_t) _count);
+    out.varint(_count ? now - _timestamps[0] : 0);
+    for (size_t i = 0; i < _count; i++) {
+        uint8_t mask = 0;
+        for (size_t j = 0; j < SENSOR_DESCRIPTOR_COUNT; j++) {
+            if (_samples[i].known(SENSOR_DESCRIPTORS[j].field)) {
+                mask |= 1 << j;
+            }
+        }
+        out.varint(delta(_timestamps, i));
+        out.byte(mask);
+        // Each known value as the difference to the last known value of
+        // the same field, slowly changing values take one byte.
+        for (size_t j = 0; j < SENSOR_DESCRIPTOR_COUNT; j++) {
+            if (mask & (1 << j)) {
+                int32_t value = _samples[i].raw(SENSOR_DESCRIPTORS[j].field);
+                out.zigzag(value - previous[j]);
+                previous[j] = value;
+            }
+        }
+    }
+    return out.length();
+}
@@ -0,0 +1,56 @@
+#ifndef SAMPLE_BATCH_H
+#define SAMPLE_BATCH_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "measurement.h"
+
+// Most samples one batch message can carry.
+#ifndef SAMPLE_BATCH_CAPACITY
+#define SAMPLE_BATCH_CAPACITY 16
+#endif
+// Size of the batch payload buffer, a full batch in the json encoding with
+// every value at its widest fits.
+#define SAMPLE_BATCH_PAYLOAD_SIZE 1280
+
+// Wire formats of a batch, see doc/batch_payload.md for the schemas.
+enum class BatchEncoding : uint8_t {
+    Json,
+    MessagePack,
+    Binary
+};
+
+const char* batchEncodingName(BatchEncoding encoding);
+// Accepts the names returned by batchEncodingName, false if unknown.
+bool parseBatchEncoding(const char* name, BatchEncoding& encoding);
+
+// Samples collected for one batch message, all storage is inline. Timestamps
+// are seconds since boot, the encodings carry the age of the first sample
+// and the seconds between consecutive ones.
+class SampleBatch {
+public:
+    SampleBatch();
+
+    void clear();
+    // Returns false when the batch is full.
+    bool add(uint32_t timestamp, const SensirionMeasurement& data);
+
+    size_t size() const { return _count; }
+    bool empty() const { return _count == 0; }
+    uint32_t timestamp(size_t index) const { return _timestamps[index]; }
+    const SensirionMeasurement& sample(size_t index) const { return _samples[index]; }
+
+    // Encodes the batch as it is at now (seconds since boot). Returns the
+    // length written, 0 if buf is too small.
+    size_t encode(BatchEncoding encoding, uint32_t now, uint8_t* buf, size_t size) const;
+
+private:
+    size_t encodeJson(uint32_t now, char* buf, size_t size) const;
+    size_t encodeMessagePack(uint32_t now, uint8_t* buf, size_t size) const;
+    size_t encodeBinary(uint32_t now, uint8_t* buf, size_t size) const;
+
+    uint32_t _timestamps[SAMPLE_BATCH_CAPACITY];
+    SensirionMeasurement _samples[SAMPLE_BATCH_CAPACITY];
+    size_t _count;
+};
+#endif
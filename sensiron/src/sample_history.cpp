@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "sample_history.h"
+#include "sensor_fields.h"
+#include "state_payload.h"
+
+static void setRaw(SensirionMeasurement& data, SensorField field, int32_t value) {
+    switch (field) {
+    case SensorField::Pm1p0: data.rawPm1p0 = (uint16_t) value; break;
+    case SensorField::Pm2p5: data.rawPm2p5 = (uint16_t) value; break;
+    case SensorField::Pm4p0: data.rawPm4p0 = (uint16_t) value; break;
+    case SensorField::Pm10p0: data.rawPm10p0 = (uint16_t) value; break;
+    case SensorField::Humidity: data.rawHumidity = (int16_t) value; break;
+    case SensorField::Temperature: data.rawTemperature = (int16_t) value; break;
+    case SensorField::VocIndex: data.rawVocIndex = (int16_t) value; break;
+    case SensorField::NoxIndex: data.rawNoxIndex = (int16_t) value; break;
+    }
+}
+
+void Rollup::reset(uint32_t period) {
+    memset(_sum, 0, sizeof(_sum));
+    memset(_known, 0, sizeof(_known));
+    _period = period;
+    _count = 0;
+}
+
+void Rollup::add(const SensirionMeasurement& data) {
+    for (size_t i = 0; i < SENSOR_FIELD_COUNT; i++) {
+        SensorField field = (SensorField) i;
+        if (data.known(field)) {
+            _sum[i] += data.raw(field);
+            _known[i]++;
+        }
+    }
+    _count++;
+}
+
+SensirionMeasurement Rollup::mean() const {
+    SensirionMeasurement mean;
+
+    for (size_t i = 0; i < SENSOR_FIELD_COUNT; i++) {
+        if (_known[i] == 0) {
+            continue;
+        }
+        // Rounded half away from zero, like the window means.
+        int32_t known = _known[i];
+        int32_t half = _sum[i] < 0 ? -known : known;
+        setRaw(mean, (SensorField) i, (2 * _sum[i] + half) / (2 * known));
+    }
+    return mean;
+}
+
+
+uint32_t SampleHistory::interval(HistoryResolution resolution) {
+    switch (resolution) {
+    case HistoryResolution::Minute: return 60;
+    case HistoryResolution::QuarterHour: return 900;
+    default: return 1;
+    }
+}
+
+uint32_t SampleHistory::begin(HistoryResolution resolution) const {
+    switch (resolution) {
+    case HistoryResolution::Minute: return _minutes.begin();
+    case HistoryResolution::QuarterHour: return _quarters.begin();
+    default: return _raw.begin();
+    }
+}
+
+uint32_t SampleHistory::end(HistoryResolution resolution) const {
+    switch (resolution) {
+    case HistoryResolution::Minute: return _minutes.end();
+    case HistoryResolution::QuarterHour: return _quarters.end();
+    default: return _raw.end();
+    }
+}
+
+bool SampleHistory::get(HistoryResolution resolution, uint32_t sequence, HistoryEntry& entry) const {
+    switch (resolution) {
+    case HistoryResolution::Minute: return _minutes.get(sequence, entry);
+    case HistoryResolution::QuarterHour: return _quarters.get(sequence, entry);
+    default: return _raw.get(sequence, entry);
+    }
+}
+
+// Writes the rollup to its tier when time starts a new period, then adds the
+// sample to the running one.
+void SampleHistory::roll(Rollup& rollup, HistoryResolution resolution, uint32_t time,
+                         const SensirionMeasurement& data) {
+    uint32_t period = time / interval(resolution);
+
+    if (rollup.count() == 0 || period != rollup.period()) {
+        if (rollup.count() > 0) {
+            HistoryEntry entry = {rollup.period() * interval(resolution), rollup.mean()};
+            if (resolution == HistoryResolution::Minute) {
+                _minutes.push(entry);
+            } else {
+                _quarters.push(entry);
+            }
+        }
+        rollup.reset(period);
+    }
+    rollup.add(data);
+}
+
+void SampleHistory::add(uint32_t time, const SensirionMeasurement& data) {
+    HistoryEntry entry = {time, data};
+
+    _raw.push(entry);
+    roll(_minute, HistoryResolution::Minute, time, data);
+    roll(_quarter, HistoryResolution::QuarterHour, time, data);
+}
+
+
+static const char* const RESOLUTION_NAMES[HISTORY_RESOLUTION_COUNT] = {"raw", "1m", "15m"};
+
+bool parseHistoryQuery(const char* field, const char* resolution, const char* format, uint32_t now,
+                       HistoryQuery& query) {
+    const SensorDescriptor* descriptor = nullptr;
+
+    for (const SensorDescriptor& candidate : SENSOR_DESCRIPTORS) {
+        if (field && strcmp(field, candidate.key) == 0) {
+            descriptor = &candidate;
+        }
+    }
+    if (!descriptor) {
+        return false;
+    }
+    query.field = descriptor->field;
+
+    size_t i = 0;
+    while (i < HISTORY_RESOLUTION_COUNT && !(resolution && strcmp(resolution, RESOLUTION_NAMES[i]) == 0)) {
+        i++;
+    }
+    if (i == HISTORY_RESOLUTION_COUNT) {
+        return false;
+    }
+    query.resolution = (HistoryResolution) i;
+
+    if (!format || strcmp(format, "json") == 0) {
+        query.format = HistoryFormat::Json;
+    } else if (strcmp(format, "csv") == 0) {
+        query.format = HistoryFormat::Csv;
+    } else {
+        return false;
+    }
+    query.now = now;
+    query.points = 0;
+    query.stage = 0;
+    query.pendingLength = 0;
+    query.pendingSent = 0;
+    return true;
+}
+
+// Stages of a response.
+enum : uint8_t {
+    HISTORY_HEADER,
+    HISTORY_ENTRIES,
+    HISTORY_FOOTER,
+    HISTORY_DONE
+};
+
+// Formats the entry as one point into buf, returns the length.
+static size_t formatEntry(const HistoryQuery& query, const HistoryEntry& entry, bool first, char* buf,
+                          size_t size) {
+    char value[16] = "";
+    int n;
+
+    if (!entry.data.known(query.field) || !formatValue(value, sizeof(value), entry.data, query.field)) {
+        strcpy(value, query.format == HistoryFormat::Json ? "null" : "");
+    }
+    long age = (long) (query.now - entry.time);
+    if (query.format == HistoryFormat::Json) {
+        n = snprintf(buf, size, "%s[%ld,%s]", first ? "" : ",", age, value);
+    } else {
+        n = snprintf(buf, size, "%ld,%s\n", age, value);
+    }
+    return n < 0 ? 0 : (size_t) n < size ? n : size - 1;
+}
+
+// Formats the header, the next entry or the footer into query.pending.
+// False once the response is complete.
+static bool nextPending(const SampleHistory& history, HistoryQuery& query) {
+    char* pending = query.pending;
+    const size_t size = sizeof(query.pending);
+    const char* key = "";
+    int n = 0;
+
+    for (const SensorDescriptor& descriptor : SENSOR_DESCRIPTORS) {
+        if (descriptor.field == query.field) {
+            key = descriptor.key;
+        }
+    }
+
+    query.pendingLength = 0;
+    query.pendingSent = 0;
+    switch (query.stage) {
+    case HISTORY_HEADER:
+        if (query.format == HistoryFormat::Json) {
+            n = snprintf(pending, size, "{\"field\":\"%s\",\"res\":\"%s\",\"interval\":%lu,\"points\":[", key,
+                         RESOLUTION_NAMES[(size_t) query.resolution],
+                         (unsigned long) SampleHistory::interval(query.resolution));
+        } else {
+            n = snprintf(pending, size, "age,%s\n", key);
+        }
+        // Entries added while the response is sent are left for the next one.
+        query.next = history.begin(query.resolution);
+        query.end = history.end(query.resolution);
+        query.stage = HISTORY_ENTRIES;
+        break;
+    case HISTORY_ENTRIES: {
+        HistoryEntry entry;
+        // Skip what was overwritten since the previous piece.
+        uint32_t begin = history.begin(query.resolution);
+        if (query.next < begin) {
+            query.next = begin;
+        }
+        while (query.next < query.end) {
+            if (history.get(query.resolution, query.next++, entry)) {
+                n = formatEntry(query, entry, query.points == 0, pending, size);
+                query.points++;
+                break;
+            }
+        }
+        if (n == 0) {
+            query.stage = HISTORY_FOOTER;
+            return nextPending(history, query);
+        }
+        break;
+    }
+    case HISTORY_FOOTER:
+        if (query.format == HistoryFormat::Json) {
+            n = snprintf(pending, size, "]}");
+        }
+        query.stage = HISTORY_DONE;
+        if (n == 0) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+    query.pendingLength = n < 0 ? 0 : (size_t) n < size ? n : size - 1;
+    return true;
+}
+
+size_t formatHistory(const SampleHistory& history, HistoryQuery& query, char* buf, size_t size) {
+    size_t pos = 0;
+
+    while (pos < size) {
+        if (query.pendingSent == query.pendingLength && !nextPending(history, query)) {
+            break;
+        }
+        size_t count = query.pendingLength - query.pendingSent;
+        if (count > size - pos) {
+            count = size - pos;
+        }
+        memcpy(buf + pos, query.pending + query.pendingSent, count);
+        query.pendingSent += count;
+        pos += count;
+    }
+    return pos;
+}
@@ -0,0 +1,156 @@
+#ifndef SAMPLE_HISTORY_H
+#define SAMPLE_HISTORY_H
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "measurement.h"
+
+// Entries kept per resolution, all memory is allocated at compile time. The
+// defaults keep 2 minutes of samples, 3 hours of 1 minute means and a day of
+// 15 minute means in about 8 KB.
+#ifndef HISTORY_RAW_CAPACITY
+#define HISTORY_RAW_CAPACITY 120
+#endif
+#ifndef HISTORY_MINUTE_CAPACITY
+#define HISTORY_MINUTE_CAPACITY 180
+#endif
+#ifndef HISTORY_QUARTER_CAPACITY
+#define HISTORY_QUARTER_CAPACITY 96
+#endif
+
+enum class HistoryResolution : uint8_t {
+    Raw,
+    Minute,
+    QuarterHour
+};
+
+const size_t HISTORY_RESOLUTION_COUNT = 3;
+
+struct HistoryEntry {
+    // Seconds since boot, of the sample or the start of the rollup period.
+    uint32_t time;
+    SensirionMeasurement data;
+};
+
+// Sums of the known values of every field over one rollup period. Integer
+// sums keep the means exact and cost no float math per sample.
+class Rollup {
+public:
+    void reset(uint32_t period);
+    void add(const SensirionMeasurement& data);
+
+    uint32_t period() const { return _period; }
+    uint32_t count() const { return _count; }
+    // Per field mean rounded to the sensor's resolution, unknown when no
+    // known value was added.
+    SensirionMeasurement mean() const;
+
+private:
+    int32_t _sum[SENSOR_FIELD_COUNT] = {};
+    uint16_t _known[SENSOR_FIELD_COUNT] = {};
+    uint32_t _period = 0;
+    uint32_t _count = 0;
+};
+
+// Fixed capacity ring of entries addressed by a sequence number that counts
+// every push. A reader may run concurrently with the single writer: the slot
+// the next push overwrites is never handed out, and an entry overwritten
+// while it was copied is reported as gone.
+template <size_t Capacity>
+class HistoryTier {
+    static_assert(Capacity >= 2, "a tier needs at least two entries");
+
+public:
+    void push(const HistoryEntry& entry) {
+        uint32_t added = _added.load(std::memory_order_relaxed);
+        _entries[added % Capacity] = entry;
+        _added.store(added + 1, std::memory_order_release);
+    }
+
+    // Sequence numbers [begin(), end()) are readable.
+    uint32_t end() const { return _added.load(std::memory_order_acquire); }
+    uint32_t begin() const {
+        uint32_t added = end();
+        return added > Capacity - 1 ? added - (Capacity - 1) : 0;
+    }
+
+    bool get(uint32_t sequence, HistoryEntry& entry) const {
+        if (sequence < begin() || sequence >= end()) {
+            return false;
+        }
+        entry = _entries[sequence % Capacity];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return sequence >= begin();
+    }
+
+private:
+    HistoryEntry _entries[Capacity];
+    std::atomic<uint32_t> _added{0};
+};
+
+// The samples of one sensor at three resolutions: every sample, 1 minute and
+// 15 minute means. Each sample updates the running rollups, a period is
+// written to its tier once the first sample of the next one arrives, so no
+// tier is ever rescanned. Free of Arduino dependencies so it can be checked
+// on the host.
+class SampleHistory {
+public:
+    // time in seconds since boot, not decreasing.
+    void add(uint32_t time, const SensirionMeasurement& data);
+
+    static uint32_t interval(HistoryResolution resolution);
+    uint32_t begin(HistoryResolution resolution) const;
+    uint32_t end(HistoryResolution resolution) const;
+    bool get(HistoryResolution resolution, uint32_t sequence, HistoryEntry& entry) const;
+
+private:
+    void roll(Rollup& rollup, HistoryResolution resolution, uint32_t time, const SensirionMeasurement& data);
+
+    HistoryTier<HISTORY_RAW_CAPACITY> _raw;
+    HistoryTier<HISTORY_MINUTE_CAPACITY> _minutes;
+    HistoryTier<HISTORY_QUARTER_CAPACITY> _quarters;
+    Rollup _minute;
+    Rollup _quarter;
+};
+
+enum class HistoryFormat : uint8_t {
+    Json,
+    Csv
+};
+
+// One /history request, streamed in pieces by formatHistory().
+struct HistoryQuery {
+    SensorField field;
+    HistoryResolution resolution;
+    HistoryFormat format;
+    // Seconds since boot when the request came in, ages count from here.
+    uint32_t now;
+    // Next entry and the end of the snapshot taken by the first call.
+    uint32_t next;
+    uint32_t end;
+    uint32_t points;
+    uint8_t stage;
+    // The header, entry or footer being sent, and how much of it went out
+    // with the previous pieces.
+    char pending[80];
+    uint8_t pendingLength;
+    uint8_t pendingSent;
+};
+
+// Fills the query from the request parameters, the field by its state
+// document key, the resolution "raw", "1m" or "15m" and the format "json"
+// or "csv", json when not given. False if a parameter is not known.
+bool parseHistoryQuery(const char* field, const char* resolution, const char* format, uint32_t now,
+                       HistoryQuery& query);
+
+// Writes the next piece of the response to buf and returns its length, 0
+// once the response is complete. A piece fills buf, an entry that does not
+// fit is continued in the next piece, so any size above 0 works.
+//   json: {"field":"pm2p5","res":"1m","interval":60,"points":[[age,value],...]}
+//   csv:  age,pm2p5 followed by one line per entry
+// age is in seconds before the request, oldest entry first, unknown values
+// are null in json and empty in csv.
+size_t formatHistory(const SampleHistory& history, HistoryQuery& query, char* buf, size_t size);
+
+#endif
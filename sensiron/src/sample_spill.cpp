@@ -0,0 +1,81 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "log.h"
+#include "sample_spill.h"
+
+SampleSpill::SampleSpill(const char* path, size_t recordSize, size_t maxRecords) {
+    _path = path;
+    _recordSize = recordSize;
+    _maxRecords = maxRecords;
+    _written = 0;
+    _read = 0;
+    _mounted = false;
+}
+
+bool SampleSpill::begin() {
+    _mounted = LittleFS.begin();
+    if (!_mounted) {
+        LOG_WARN("LittleFS mount failed, sample spill disabled");
+        return false;
+    }
+    reset();
+    return true;
+}
+
+bool SampleSpill::append(const void* record) {
+    if (!_mounted || _written >= _maxRecords) {
+        return false;
+    }
+    File file = LittleFS.open(_path, "a");
+    if (!file) {
+        return false;
+    }
+    size_t n = file.write((const uint8_t*) record, _recordSize);
+    file.close();
+    if (n != _recordSize) {
+        return false;
+    }
+    _written++;
+    return true;
+}
+
+bool SampleSpill::peek(void* record) {
+    if (pending() == 0) {
+        return false;
+    }
+    File file = LittleFS.open(_path, "r");
+    if (!file) {
+        reset();
+        return false;
+    }
+    bool ok = file.seek(_read * _recordSize) &&
+              file.read((uint8_t*) record, _recordSize) == _recordSize;
+    file.close();
+    if (!ok) {
+        reset();
+        return false;
+    }
+    return true;
+}
+
+void SampleSpill::pop() {
+    if (pending() == 0) {
+        return;
+    }
+    _read++;
+    if (_read == _written) {
+        reset();
+    }
+}
+
+size_t SampleSpill::pending() {
+    return _written - _read;
+}
+
+void SampleSpill::reset() {
+    if (_mounted && LittleFS.exists(_path)) {
+        LittleFS.remove(_path);
+    }
+    _written = 0;
+    _read = 0;
+}
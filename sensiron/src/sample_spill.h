@@ -0,0 +1,32 @@
+#ifndef SAMPLE_SPILL_H
+#define SAMPLE_SPILL_H
+#include <Arduino.h>
+
+// Append only overflow file on LittleFS for fixed size records. Records are
+// read back in the order they were written, the file is removed once every
+// record has been popped.
+class SampleSpill {
+public:
+    SampleSpill(const char* path, size_t recordSize, size_t maxRecords);
+
+    // Mounts the filesystem and removes records left from a previous boot,
+    // their timestamps are relative to that boot and can not be replayed.
+    bool begin();
+    bool append(const void* record);
+    // Reads the oldest record without removing it.
+    bool peek(void* record);
+    // Removes the oldest record.
+    void pop();
+    size_t pending();
+
+private:
+    void reset();
+
+    const char* _path;
+    size_t _recordSize;
+    size_t _maxRecords;
+    size_t _written;
+    size_t _read;
+    bool _mounted;
+};
+#endif
@@ -0,0 +1,92 @@
+#ifndef SAMPLING_SCHEDULER_H
+#define SAMPLING_SCHEDULER_H
+#include <stddef.h>
+
+// The SEN5x produces a new sample every second. Instead of reading on a
+// fixed timer the data-ready flag is polled shortly before the next sample
+// is expected and then every POLL_RETRY_MS until it is set, so each sample
+// is read exactly once with one or two cheap status reads. Publishing runs
+// on its own, configurable, interval.
+//
+// With several sensors on one bus every sensor keeps its own poll timing.
+// nextPoll() hands the bus to at most one sensor per call and sensors that
+// are due at the same time take turns, so one call never costs more than
+// one sensor's transactions. Starting the sensors startOffset() apart
+// spreads their samples over the second.
+class SamplingScheduler {
+public:
+    static const unsigned long SAMPLE_PERIOD_MS = 1000;
+    static const unsigned long POLL_LEAD_MS = 50;
+    static const unsigned long POLL_RETRY_MS = 100;
+    static const size_t MAX_SENSORS = 8;
+
+    SamplingScheduler(unsigned long publishInterval, size_t sensors = 1)
+        : _publishInterval(publishInterval), _lastPublish(0), _next(0) {
+        _sensors = sensors < 1 ? 1 : sensors > MAX_SENSORS ? MAX_SENSORS : sensors;
+        for (size_t i = 0; i < MAX_SENSORS; i++) {
+            _lastSample[i] = 0;
+            _lastPoll[i] = 0;
+        }
+    }
+
+    void setPublishInterval(unsigned long publishInterval) { _publishInterval = publishInterval; }
+    unsigned long publishInterval() const { return _publishInterval; }
+    size_t sensors() const { return _sensors; }
+
+    // Sensor whose data-ready flag should be checked now, -1 for none.
+    int nextPoll(unsigned long now) {
+        for (size_t i = 0; i < _sensors; i++) {
+            size_t sensor = (_next + i) % _sensors;
+            if (now - _lastSample[sensor] >= SAMPLE_PERIOD_MS - POLL_LEAD_MS &&
+                now - _lastPoll[sensor] >= POLL_RETRY_MS) {
+                _lastPoll[sensor] = now;
+                _next = (sensor + 1) % _sensors;
+                return (int) sensor;
+            }
+        }
+        return -1;
+    }
+
+    void sampleTaken(size_t sensor, unsigned long now) { _lastSample[sensor] = now; }
+
+    // Delay between starting sensor 0 and starting this sensor.
+    unsigned long startOffset(size_t sensor) const { return sensor * SAMPLE_PERIOD_MS / _sensors; }
+
+    bool publishDue(unsigned long now) {
+        if (now - _lastPublish < _publishInterval) {
+            return false;
+        }
+        _lastPublish = now;
+        return true;
+    }
+
+    // Milliseconds until nextPoll() or publishDue() can be true again, the
+    // time the loop may sleep.
+    unsigned long idleTime(unsigned long now) const {
+        unsigned long idle = remaining(now - _lastPublish, _publishInterval);
+        for (size_t i = 0; i < _sensors; i++) {
+            unsigned long poll = remaining(now - _lastSample[i], SAMPLE_PERIOD_MS - POLL_LEAD_MS);
+            unsigned long retry = remaining(now - _lastPoll[i], POLL_RETRY_MS);
+            if (retry > poll) {
+                poll = retry;
+            }
+            if (poll < idle) {
+                idle = poll;
+            }
+        }
+        return idle;
+    }
+
+private:
+    static unsigned long remaining(unsigned long elapsed, unsigned long interval) {
+        return elapsed >= interval ? 0 : interval - elapsed;
+    }
+
+    unsigned long _publishInterval;
+    unsigned long _lastSample[MAX_SENSORS];
+    unsigned long _lastPoll[MAX_SENSORS];
+    unsigned long _lastPublish;
+    size_t _sensors;
+    size_t _next;
+};
+#endif
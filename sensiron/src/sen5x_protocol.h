@@ -0,0 +1,40 @@
+#ifndef SEN5X_PROTOCOL_H
+#define SEN5X_PROTOCOL_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "measurement.h"
+
+// SEN5x I2C framing as in the datasheet: 16 bit big endian commands, data
+// in 16 bit big endian words each followed by a CRC8 (poly 0x31, init 0xFF).
+// Shared by the firmware and the simulated sensor of the native build.
+
+#define SEN5X_I2C_ADDRESS 0x69
+
+#define SEN5X_CMD_START_MEASUREMENT 0x0021
+#define SEN5X_CMD_STOP_MEASUREMENT 0x0104
+#define SEN5X_CMD_READ_DATA_READY 0x0202
+#define SEN5X_CMD_READ_MEASURED_VALUES 0x03C4
+#define SEN5X_CMD_DEVICE_RESET 0xD304
+
+// Execution times in ms, wait this long between command and read.
+#define SEN5X_DELAY_START_MEASUREMENT 50
+#define SEN5X_DELAY_READ 20
+#define SEN5X_DELAY_DEVICE_RESET 200
+
+// Words in a Read Measured Values response.
+#define SEN5X_MEASUREMENT_WORDS 8
+
+uint8_t sen5xCrc8(const uint8_t* data, size_t length);
+
+// Writes count words with their CRCs to out, 3 bytes per word. Returns the
+// number of bytes written.
+size_t sen5xEncodeWords(const uint16_t* words, size_t count, uint8_t* out);
+
+// Reads count words from in, false if any CRC does not match.
+bool sen5xDecodeWords(const uint8_t* in, size_t count, uint16_t* words);
+
+void sen5xWordsToMeasurement(const uint16_t* words, SensirionMeasurement& data);
+void sen5xMeasurementToWords(const SensirionMeasurement& data, uint16_t* words);
+
+#endif
@@ -0,0 +1,101 @@
+#include "sen5x_reader.h"
+#include "metrics.h"
+
+Sen5xReader::Sen5xReader(Sen5xBus& bus)
+    : _bus(bus), _state(State::Idle), _started(0), _commandAt(0), _retried(false), _consecutiveErrors(0),
+      _lastLatency(0) {}
+
+bool Sen5xReader::command(uint16_t command, unsigned long now) {
+    uint8_t frame[2] = {(uint8_t) (command >> 8), (uint8_t) (command & 0xFF)};
+
+    _commandAt = now;
+    return _bus.write(frame, sizeof(frame));
+}
+
+bool Sen5xReader::begin(unsigned long now) {
+    _started = now;
+    _retried = false;
+    if (!command(SEN5X_CMD_READ_DATA_READY, now)) {
+        fail(false);
+        return false;
+    }
+    _state = State::DataReady;
+    return true;
+}
+
+unsigned long Sen5xReader::idleTime(unsigned long now) const {
+    if (_state == State::Idle || now - _commandAt >= SEN5X_DELAY_READ) {
+        return 0;
+    }
+    return SEN5X_DELAY_READ - (now - _commandAt);
+}
+
+Sen5xReadResult Sen5xReader::poll(unsigned long now, SensirionMeasurement& data) {
+    uint8_t response[3 * SEN5X_MEASUREMENT_WORDS];
+    uint16_t words[SEN5X_MEASUREMENT_WORDS];
+
+    if (_state == State::Idle) {
+        return Sen5xReadResult::NotReady;
+    }
+    if (now - _commandAt < SEN5X_DELAY_READ) {
+        return Sen5xReadResult::Pending;
+    }
+
+    if (_state == State::DataReady) {
+        if (_bus.read(response, 3) != 3) {
+            return fail(false);
+        }
+        if (!sen5xDecodeWords(response, 1, words)) {
+            return fail(true);
+        }
+        _consecutiveErrors = 0;
+        // Only the low byte carries the flag.
+        if ((words[0] & 0xFF) == 0) {
+            _state = State::Idle;
+            return Sen5xReadResult::NotReady;
+        }
+        if (!command(SEN5X_CMD_READ_MEASURED_VALUES, now)) {
+            return fail(false);
+        }
+        _state = State::MeasuredValues;
+        return Sen5xReadResult::Pending;
+    }
+
+    bool received = _bus.read(response, sizeof(response)) == sizeof(response);
+    bool valid = received && sen5xDecodeWords(response, SEN5X_MEASUREMENT_WORDS, words);
+    if (!valid) {
+        if (received) {
+            metrics.i2cCrcErrors++;
+        }
+        // The values stay readable until the next sample, ask once more
+        // before the sample is lost.
+        if (!_retried && command(SEN5X_CMD_READ_MEASURED_VALUES, now)) {
+            _retried = true;
+            metrics.i2cRetries++;
+            return Sen5xReadResult::Pending;
+        }
+        return fail(false);
+    }
+    sen5xWordsToMeasurement(words, data);
+    _state = State::Idle;
+    _consecutiveErrors = 0;
+    _lastLatency = now - _started;
+    metrics.samples++;
+    return Sen5xReadResult::Sample;
+}
+
+// Ends the read, a bus that failed SEN5X_RECOVERY_THRESHOLD times in a row is
+// assumed to be held low by a sensor that lost track of a transfer.
+Sen5xReadResult Sen5xReader::fail(bool crcError) {
+    _state = State::Idle;
+    metrics.i2cErrors++;
+    if (crcError) {
+        metrics.i2cCrcErrors++;
+    }
+    if (++_consecutiveErrors >= SEN5X_RECOVERY_THRESHOLD) {
+        _consecutiveErrors = 0;
+        metrics.i2cRecoveries++;
+        _bus.recover();
+    }
+    return Sen5xReadResult::Error;
+}
@@ -0,0 +1,72 @@
+#ifndef SEN5X_READER_H
+#define SEN5X_READER_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "measurement.h"
+#include "sen5x_protocol.h"
+
+// Raw transfers with one SEN5x, implemented over Wire on the device and by
+// the simulated sensor on the host.
+class Sen5xBus {
+public:
+    virtual ~Sen5xBus() {}
+
+    // False when the sensor NACKed.
+    virtual bool write(const uint8_t* data, size_t length) = 0;
+    // Bytes received, 0 when the sensor NACKed.
+    virtual size_t read(uint8_t* data, size_t length) = 0;
+    // Frees a bus that a device holds low, true if it was released.
+    virtual bool recover() = 0;
+};
+
+// Consecutive failed reads before the bus is recovered.
+#ifndef SEN5X_RECOVERY_THRESHOLD
+#define SEN5X_RECOVERY_THRESHOLD 3
+#endif
+
+enum class Sen5xReadResult {
+    // Waiting for the sensor to execute the command, poll again later.
+    Pending,
+    // No new sample, or no read in progress.
+    NotReady,
+    Sample,
+    Error
+};
+
+// Reads one sample as data-ready check and measured values read without
+// blocking: the execution time between a command and its response is
+// returned to the caller instead of spent in delay(). A response with a bad
+// CRC or a NACK is requested once more, a bus that keeps failing is
+// recovered. Counts into metrics.
+class Sen5xReader {
+public:
+    Sen5xReader(Sen5xBus& bus);
+
+    // Sends the data-ready check, false if the sensor did not take it.
+    bool begin(unsigned long now);
+    Sen5xReadResult poll(unsigned long now, SensirionMeasurement& data);
+    // Forgets the read in progress, before other commands go to the sensor.
+    void abort() { _state = State::Idle; }
+
+    bool busy() const { return _state != State::Idle; }
+    // Milliseconds until poll() has something to do.
+    unsigned long idleTime(unsigned long now) const;
+    // Milliseconds from begin() to the last sample.
+    unsigned long lastLatency() const { return _lastLatency; }
+
+private:
+    enum class State { Idle, DataReady, MeasuredValues };
+
+    bool command(uint16_t command, unsigned long now);
+    Sen5xReadResult fail(bool crcError);
+
+    Sen5xBus& _bus;
+    State _state;
+    unsigned long _started;
+    unsigned long _commandAt;
+    bool _retried;
+    uint8_t _consecutiveErrors;
+    unsigned long _lastLatency;
+};
+#endif
@@ -29,42 +29,116 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include "bench.h"
+#include "log.h"
+#include "metrics.h"
 #include "sensirion.h"
+#include "state_payload.h"
 
-SensirionI2CSen5x sen5x;
-unsigned char serialNumber[32];
-String hw_version;
-String sw_version;
+void i2cBegin(TwoWire& wire) {
+    wire.begin(I2C_SDA_PIN, I2C_SCL_PIN);
+    wire.setClock(I2C_CLOCK_HZ);
+}
+
+// Half an SCL period at 100 kHz.
+#define I2C_RECOVERY_HALF_PERIOD_US 5
+
+bool i2cRecoverBus(TwoWire& wire) {
+#ifdef ESP32
+    // Hands the pins back from the I2C peripheral.
+    wire.end();
+#endif
+    pinMode(I2C_SDA_PIN, INPUT_PULLUP);
+    pinMode(I2C_SCL_PIN, INPUT_PULLUP);
+    // A device cut off in the middle of sending a byte releases SDA after
+    // at most nine clocks.
+    for (int i = 0; i < 9 && digitalRead(I2C_SDA_PIN) == LOW; i++) {
+        digitalWrite(I2C_SCL_PIN, LOW);
+        pinMode(I2C_SCL_PIN, OUTPUT);
+        delayMicroseconds(I2C_RECOVERY_HALF_PERIOD_US);
+        pinMode(I2C_SCL_PIN, INPUT_PULLUP);
+        delayMicroseconds(I2C_RECOVERY_HALF_PERIOD_US);
+    }
+    // STOP, SDA rises while SCL is high.
+    digitalWrite(I2C_SDA_PIN, LOW);
+    pinMode(I2C_SDA_PIN, OUTPUT);
+    delayMicroseconds(I2C_RECOVERY_HALF_PERIOD_US);
+    pinMode(I2C_SDA_PIN, INPUT_PULLUP);
+    delayMicroseconds(I2C_RECOVERY_HALF_PERIOD_US);
+    bool released = digitalRead(I2C_SDA_PIN) == HIGH && digitalRead(I2C_SCL_PIN) == HIGH;
 
-String getSen5xSerialNumber() {
+    i2cBegin(wire);
+    return released;
+}
+
+I2cMux::I2cMux(TwoWire& wire, uint8_t address) : _wire(wire), _address(address), _selected(-1) {}
 
-    return String((char*) serialNumber);
+bool I2cMux::select(uint8_t channel) {
+    if (_selected == channel) {
+        return true;
+    }
+    _wire.beginTransmission(_address);
+    _wire.write((uint8_t) (1 << channel));
+    if (_wire.endTransmission() != 0) {
+        // Unknown state, write it again next time.
+        _selected = -1;
+        return false;
+    }
+    _selected = channel;
+    return true;
 }
 
-String getSen5xHwVersion() {
-    return hw_version;
+
+Sen5xSensor::Sen5xSensor() : _wire(&Wire), _mux(nullptr), _channel(SEN5X_NO_MUX_CHANNEL), _reader(*this) {
+    _serialNumber[0] = '\0';
+    _hwVersion[0] = '\0';
+    _swVersion[0] = '\0';
 }
 
-String getSen5xSwVersion() {
-    return sw_version;
+void Sen5xSensor::attach(TwoWire& wire, I2cMux* mux, uint8_t channel) {
+    _wire = &wire;
+    _mux = mux;
+    _channel = channel;
 }
 
-void printModuleVersions() {
+// Routes the bus to this sensor, a no-op without a mux.
+bool Sen5xSensor::select() {
+    if (!_mux || _mux->select(_channel)) {
+        return true;
+    }
+    metrics.i2cErrors++;
+    LOG_ERROR("Can not select mux channel %u", _channel);
+    return false;
+}
+
+// The error text is only looked up when error logging is compiled in.
+void Sen5xSensor::logError(const char* command, uint16_t error) const {
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+    char errorMessage[64];
+    errorToString(error, errorMessage, sizeof(errorMessage));
+    if (_mux) {
+        LOG_ERROR("Error trying to execute %s() on mux channel %u: %s", command, _channel, errorMessage);
+    } else {
+        LOG_ERROR("Error trying to execute %s(): %s", command, errorMessage);
+    }
+#else
+    (void) command;
+    (void) error;
+#endif
+}
+
+void Sen5xSensor::readModuleVersions() {
     uint16_t error;
-    char errorMessage[256];
 
     unsigned char productName[32];
     uint8_t productNameSize = 32;
 
-    error = sen5x.getProductName(productName, productNameSize);
+    error = _driver.getProductName(productName, productNameSize);
 
     if (error) {
-        Serial.print("Error trying to execute getProductName(): ");
-        errorToString(error, errorMessage, 256);
-        Serial.println(errorMessage);
+        logError("getProductName", error);
     } else {
-        Serial.print("ProductName:");
-        Serial.println((char*)productName);
+        LOG_INFO("ProductName: %s", (char*) productName);
     }
 
     uint8_t firmwareMajor;
@@ -75,67 +149,93 @@ void printModuleVersions() {
     uint8_t protocolMajor;
     uint8_t protocolMinor;
 
-    error = sen5x.getVersion(firmwareMajor, firmwareMinor, firmwareDebug,
-                             hardwareMajor, hardwareMinor, protocolMajor,
-                             protocolMinor);
+    error = _driver.getVersion(firmwareMajor, firmwareMinor, firmwareDebug,
+                               hardwareMajor, hardwareMinor, protocolMajor,
+                               protocolMinor);
     if (error) {
-        Serial.print("Error trying to execute getVersion(): ");
-        errorToString(error, errorMessage, 256);
-        Serial.println(errorMessage);
+        logError("getVersion", error);
     } else {
-        Serial.print("Firmware: ");
-        Serial.print(firmwareMajor);
-        Serial.print(".");
-        Serial.print(firmwareMinor);
-        Serial.print(", ");
+        LOG_INFO("Firmware: %u.%u, Hardware: %u.%u", firmwareMajor, firmwareMinor, hardwareMajor, hardwareMinor);
+
+        snprintf(_swVersion, sizeof(_swVersion), "%u.%u", firmwareMajor, firmwareMinor);
+        snprintf(_hwVersion, sizeof(_hwVersion), "%u.%u", hardwareMajor, hardwareMinor);
+    }
+}
 
-        sw_version = String(firmwareMajor) + "." + String(firmwareMinor);
 
-        Serial.print("Hardware: ");
-        Serial.print(hardwareMajor);
-        Serial.print(".");
-        Serial.println(hardwareMinor);
-        
-        hw_version = String(hardwareMajor) + "." + String(hardwareMinor);
+void Sen5xSensor::readSerialNumber() {
+    uint16_t error;
+    uint8_t serialNumberSize = sizeof(_serialNumber);
+
+    error = _driver.getSerialNumber((unsigned char*) _serialNumber, serialNumberSize);
+    if (error) {
+        _serialNumber[0] = '\0';
+        logError("getSerialNumber", error);
+    } else {
+        LOG_INFO("SerialNumber: %s", _serialNumber);
     }
 }
 
 
-void printSerialNumber() {
+// Must be called in idle mode, returns false if any setting failed.
+bool Sen5xSensor::writeTuning(const Sen5xTuning& tuning) {
+    bool ok = true;
     uint16_t error;
-    char errorMessage[256];
-    // unsigned char serialNumber[32];
-    uint8_t serialNumberSize = 32;
 
-    error = sen5x.getSerialNumber(serialNumber, serialNumberSize);
+    // Scaled as in the SEN5x datasheet, offset in 1/200 degC and slope in
+    // 1/10000.
+    error = _driver.setTemperatureOffsetParameters((int16_t) lroundf(tuning.temperatureOffset * 200),
+                                                   (int16_t) lroundf(tuning.temperatureSlope * 10000),
+                                                   tuning.temperatureTimeConstant);
     if (error) {
-        Serial.print("Error trying to execute getSerialNumber(): ");
-        errorToString(error, errorMessage, 256);
-        Serial.println(errorMessage);
+        logError("setTemperatureOffsetParameters", error);
+        ok = false;
     } else {
-        Serial.print("SerialNumber:");
-        Serial.println((char*)serialNumber);
+        LOG_INFO("Temperature Offset set to %.2f deg. Celsius (SEN54/SEN55 only)", (double) tuning.temperatureOffset);
+    }
+    error = _driver.setFanAutoCleaningInterval(tuning.fanCleaningInterval);
+    if (error) {
+        logError("setFanAutoCleaningInterval", error);
+        ok = false;
+    }
+    error = _driver.setWarmStartParameter(tuning.warmStart);
+    if (error) {
+        logError("setWarmStartParameter", error);
+        ok = false;
     }
+    error = _driver.setRhtAccelerationMode(tuning.rhtAcceleration);
+    if (error) {
+        logError("setRhtAccelerationMode", error);
+        ok = false;
+    }
+    return ok;
 }
 
+bool Sen5xSensor::restoreVocState(const uint8_t* vocState) {
+    uint16_t error = _driver.setVocAlgorithmState(vocState, SEN5X_VOC_STATE_SIZE);
+    if (error) {
+        logError("setVocAlgorithmState", error);
+        return false;
+    }
+    return true;
+}
 
-void sen5xSetup() {
-    Wire.begin();
-    sen5x.begin(Wire);
+void Sen5xSensor::begin(const Sen5xTuning& tuning, const uint8_t* vocState) {
+    _driver.begin(*_wire);
+    if (!select()) {
+        return;
+    }
 
     uint16_t error;
-    char errorMessage[256];
-    error = sen5x.deviceReset();
+    error = _driver.deviceReset();
     if (error) {
-        Serial.print("Error trying to execute deviceReset(): ");
-        errorToString(error, errorMessage, 256);
-        Serial.println(errorMessage);
+        logError("deviceReset", error);
     }
 
 // Print SEN55 module information if i2c buffers are large enough
 #ifdef USE_PRODUCT_INFO
-    printSerialNumber();
-    printModuleVersions();
+    readSerialNumber();
+    readModuleVersions();
 #endif
 
     // set a temperature offset in degrees celsius
@@ -154,86 +254,137 @@ void sen5xSetup() {
     // in `setTemperatureOffsetParameters`, `setWarmStartParameter` and
     // `setRhtAccelerationMode`.
     //
-    // Adjust tempOffset to account for additional temperature offsets
+    // The offset, slope and time constant come from the tuning, set on the
+    // command topic, to account for additional temperature offsets
     // exceeding the SEN module's self heating.
-    float tempOffset = 0.0;
-    error = sen5x.setTemperatureOffsetSimple(tempOffset);
-    if (error) {
-        Serial.print("Error trying to execute setTemperatureOffsetSimple(): ");
-        errorToString(error, errorMessage, 256);
-        Serial.println(errorMessage);
-    } else {
-        Serial.print("Temperature Offset set to ");
-        Serial.print(tempOffset);
-        Serial.println(" deg. Celsius (SEN54/SEN55 only");
+    writeTuning(tuning);
+    // The state is reset when the measurement starts unless it is restored
+    // in idle mode first.
+    if (vocState && restoreVocState(vocState)) {
+        LOG_INFO("VOC algorithm state restored");
     }
+}
 
-    // Start Measurement
-    error = sen5x.startMeasurement();
+bool Sen5xSensor::start() {
+    _reader.abort();
+    if (!select()) {
+        return false;
+    }
+    uint16_t error = _driver.startMeasurement();
     if (error) {
-        Serial.print("Error trying to execute startMeasurement(): ");
-        errorToString(error, errorMessage, 256);
-        Serial.println(errorMessage);
+        logError("startMeasurement", error);
+        return false;
     }
+    return true;
 }
 
 
-SensirionMeasurement readSen5xData() {
+bool Sen5xSensor::applyTuning(const Sen5xTuning& tuning) {
+    uint8_t vocState[SEN5X_VOC_STATE_SIZE];
+    // Also aborts a read in progress.
+    bool haveState = getVocState(vocState);
     uint16_t error;
-    char errorMessage[256];
-    SensirionMeasurement data;
 
-    error = sen5x.readMeasuredValues(
-            data.massConcentrationPm1p0, data.massConcentrationPm2p5, data.massConcentrationPm4p0,
-            data.massConcentrationPm10p0, data.ambientHumidity, data.ambientTemperature, data.vocIndex,
-            data.noxIndex);
+    if (!select()) {
+        return false;
+    }
+    error = _driver.stopMeasurement();
+    if (error) {
+        logError("stopMeasurement", error);
+        return false;
+    }
+    bool ok = writeTuning(tuning);
+    if (haveState) {
+        restoreVocState(vocState);
+    }
+    error = _driver.startMeasurement();
+    if (error) {
+        logError("startMeasurement", error);
+        return false;
+    }
+    return ok;
+}
 
+bool Sen5xSensor::getVocState(uint8_t state[SEN5X_VOC_STATE_SIZE]) {
+    _reader.abort();
+    if (!select()) {
+        return false;
+    }
+    uint16_t error = _driver.getVocAlgorithmState(state, SEN5X_VOC_STATE_SIZE);
     if (error) {
-        Serial.print("Error trying to execute readMeasuredValues(): ");
-        errorToString(error, errorMessage, 256);
-        Serial.println(errorMessage);
+        logError("getVocAlgorithmState", error);
+        return false;
+    }
+    return true;
+}
+
+
+bool Sen5xSensor::write(const uint8_t* data, size_t length) {
+    BENCH_SCOPE("sen5xWrite");
+
+    if (!select()) {
+        return false;
+    }
+    uint32_t start = micros();
+    _wire->beginTransmission(SEN5X_I2C_ADDRESS);
+    _wire->write(data, length);
+    bool ok = _wire->endTransmission() == 0;
+    metrics.i2cWrite.observe(micros() - start);
+    return ok;
+}
+
+size_t Sen5xSensor::read(uint8_t* data, size_t length) {
+    BENCH_SCOPE("sen5xRead");
+
+    if (!select()) {
+        return 0;
+    }
+    uint32_t start = micros();
+    size_t received = _wire->requestFrom((uint8_t) SEN5X_I2C_ADDRESS, (uint8_t) length);
+    for (size_t i = 0; i < received; i++) {
+        data[i] = (uint8_t) _wire->read();
+    }
+    metrics.i2cRead.observe(micros() - start);
+    return received == length ? length : 0;
+}
+
+bool Sen5xSensor::recover() {
+    bool released = i2cRecoverBus(*_wire);
+    if (_mux) {
+        _mux->invalidate();
+    }
+    if (released) {
+        LOG_WARN("I2C bus recovered");
     } else {
-        
-        Serial.print("MassConcentrationPm1p0:");
-        Serial.print(data.massConcentrationPm1p0);
-        Serial.print("\t");
-        Serial.print("MassConcentrationPm2p5:");
-        Serial.print(data.massConcentrationPm2p5);
-        Serial.print("\t");
-        Serial.print("MassConcentrationPm4p0:");
-        Serial.print(data.massConcentrationPm4p0);
-        Serial.print("\t");
-        Serial.print("MassConcentrationPm10p0:");
-        Serial.print(data.massConcentrationPm10p0);
-        Serial.print("\t");
-        Serial.print("AmbientHumidity:");
-        if (isnan(data.ambientHumidity)) {
-            Serial.print("n/a");
-        } else {
-            Serial.print(data.ambientHumidity);
-        }
-        Serial.print("\t");
-        Serial.print("AmbientTemperature:");
-        if (isnan(data.ambientTemperature)) {
-            Serial.print("n/a");
-        } else {
-            Serial.print(data.ambientTemperature);
-        }
-        Serial.print("\t");
-        Serial.print("VocIndex:");
-        if (isnan(data.vocIndex)) {
-            Serial.print("n/a");
+        LOG_ERROR("I2C bus still held low after recovery");
+    }
+    return released;
+}
+
+
+bool Sen5xSensor::beginRead(unsigned long now) {
+    return _reader.begin(now);
+}
+
+
+Sen5xReadResult Sen5xSensor::pollRead(unsigned long now, SensirionMeasurement& data) {
+    Sen5xReadResult result = _reader.poll(now, data);
+
+    if (result == Sen5xReadResult::Error) {
+        if (_mux) {
+            LOG_ERROR("Can not read the SEN5x on mux channel %u", _channel);
         } else {
-            Serial.print(data.vocIndex);
+            LOG_ERROR("Can not read the SEN5x");
         }
-        Serial.print("\t");
-        Serial.print("NoxIndex:");
-        if (isnan(data.noxIndex)) {
-            Serial.println("n/a");
-        } else {
-            Serial.println(data.noxIndex);
+    }
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+    if (result == Sen5xReadResult::Sample) {
+        // Rendered like the state payload, without float formatting.
+        char line[STATE_PAYLOAD_SIZE];
+        if (formatMeasurement(line, sizeof(line), data)) {
+            LOG_DEBUG("Sample %s", line);
         }
     }
-    
-    return data;
+#endif
+    return result;
 }
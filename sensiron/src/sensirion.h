@@ -5,6 +5,10 @@
 #include <SensirionI2CSen5x.h>
 #include <Wire.h>
 
+#include "measurement.h"
+#include "pipeline_io.h"
+#include "sen5x_reader.h"
+
 // The used commands use up to 48 bytes. On some Arduino's the default buffer
 // space is not large enough
 #define MAXBUF_REQUIREMENT 48
@@ -15,23 +19,135 @@
 #define USE_PRODUCT_INFO
 #endif
 
+// Size of the VOC algorithm state, see sen5xGetVocState().
+#define SEN5X_VOC_STATE_SIZE 8
+
+// RHT acceleration modes of setRhtAccelerationMode.
+#define SEN5X_RHT_ACCELERATION_LOW 0
+#define SEN5X_RHT_ACCELERATION_HIGH 1
+#define SEN5X_RHT_ACCELERATION_MEDIUM 2
+
+// Default of the fan auto cleaning interval, one week.
+#define SEN5X_FAN_CLEANING_INTERVAL_DEFAULT 604800
 
-struct SensirionMeasurement
-{
-    float massConcentrationPm1p0;
-    float massConcentrationPm2p5;
-    float massConcentrationPm4p0;
-    float massConcentrationPm10p0;
-    float ambientHumidity;
-    float ambientTemperature;
-    float vocIndex;
-    float noxIndex;
+// Temperature compensation and algorithm settings, applied together. See the
+// "SEN5x Temperature Compensation Instruction" application note.
+struct Sen5xTuning {
+    // Added to the compensated temperature: offset + slope * temperature,
+    // reached with the time constant in seconds, 0 for immediately.
+    float temperatureOffset = 0.0f;
+    float temperatureSlope = 0.0f;
+    uint16_t temperatureTimeConstant = 0;
+    // 0 (default) to 65535, higher values speed up the temperature
+    // compensation after a cold start.
+    uint16_t warmStart = 0;
+    uint16_t rhtAcceleration = SEN5X_RHT_ACCELERATION_LOW;
+    // Seconds between fan cleanings, 0 disables them.
+    uint32_t fanCleaningInterval = SEN5X_FAN_CLEANING_INTERVAL_DEFAULT;
 };
 
-void sen5xSetup();
-SensirionMeasurement readSen5xData();
-String getSen5xSerialNumber();
-String getSen5xHwVersion();
-String getSen5xSwVersion();
+// The SEN5x only supports standard mode I2C, fast mode (400 kHz) is outside
+// its datasheet limits. Slower clocks are fine for long cables.
+#define SEN5X_I2C_MAX_CLOCK_HZ 100000
+#ifndef I2C_CLOCK_HZ
+#define I2C_CLOCK_HZ SEN5X_I2C_MAX_CLOCK_HZ
+#endif
+static_assert(I2C_CLOCK_HZ <= SEN5X_I2C_MAX_CLOCK_HZ, "I2C_CLOCK_HZ exceeds the SEN5x maximum of 100 kHz");
+
+#ifndef I2C_SDA_PIN
+#define I2C_SDA_PIN SDA
+#endif
+#ifndef I2C_SCL_PIN
+#define I2C_SCL_PIN SCL
+#endif
+
+// Starts wire on I2C_SDA_PIN and I2C_SCL_PIN at I2C_CLOCK_HZ.
+void i2cBegin(TwoWire& wire);
+// Clocks SCL until a device holding SDA low lets go, sends a STOP and
+// starts wire again. True if both lines are high afterwards.
+bool i2cRecoverBus(TwoWire& wire);
+
+// TCA9548A I2C multiplexer. Every SEN5x has the same fixed address, so
+// several sensors on one bus each sit on a channel of their own.
+#ifndef SEN5X_MUX_ADDRESS
+#define SEN5X_MUX_ADDRESS 0x70
+#endif
+
+class I2cMux {
+public:
+    I2cMux(TwoWire& wire, uint8_t address = SEN5X_MUX_ADDRESS);
+
+    // Connects channel to the bus, the mux is only written when the channel
+    // changes.
+    bool select(uint8_t channel);
+    // The next select() writes the mux, after a bus recovery.
+    void invalidate() { _selected = -1; }
+
+private:
+    TwoWire& _wire;
+    uint8_t _address;
+    int _selected;
+};
+
+// Channel of a sensor that is not behind a mux.
+#define SEN5X_NO_MUX_CHANNEL 0xFF
+
+// One SEN5x with its driver state. i2cBegin() must have been called.
+// Configuration goes through the Sensirion driver, the samples are read
+// with a Sen5xReader over the raw bus.
+class Sen5xSensor : public Sensor, private Sen5xBus {
+public:
+    // Directly on Wire until attached elsewhere.
+    Sen5xSensor();
+
+    // The sensor on wire, behind channel of mux when one is given.
+    void attach(TwoWire& wire, I2cMux* mux, uint8_t channel);
+
+    // Resets the sensor, applies the tuning and restores the VOC algorithm
+    // state when one is given. The measurement is started by start().
+    void begin(const Sen5xTuning& tuning, const uint8_t* vocState);
+    bool start();
+    // Stops the measurement to apply the tuning and starts it again, the VOC
+    // algorithm state is carried over. Warm start and RHT acceleration are
+    // only accepted in idle mode.
+    bool applyTuning(const Sen5xTuning& tuning);
+    // Reads the VOC algorithm state, it lets the VOC index continue where it
+    // was after a restart instead of learning the baseline again for hours.
+    // The NOx algorithm has no such interface.
+    bool getVocState(uint8_t state[SEN5X_VOC_STATE_SIZE]);
+    // Starts reading a sample, pollRead() until it is no longer Pending.
+    // Other commands abort a read in progress.
+    bool beginRead(unsigned long now) override;
+    Sen5xReadResult pollRead(unsigned long now, SensirionMeasurement& data) override;
+    bool reading() const override { return _reader.busy(); }
+    // Milliseconds until pollRead() has something to do.
+    unsigned long readIdleTime(unsigned long now) const override { return _reader.idleTime(now); }
+
+    const char* serialNumber() const override { return _serialNumber; }
+    const char* hwVersion() const override { return _hwVersion; }
+    const char* swVersion() const override { return _swVersion; }
+
+private:
+    bool write(const uint8_t* data, size_t length) override;
+    size_t read(uint8_t* data, size_t length) override;
+    bool recover() override;
+
+    bool select();
+    bool writeTuning(const Sen5xTuning& tuning);
+    bool restoreVocState(const uint8_t* vocState);
+    void readSerialNumber();
+    void readModuleVersions();
+    void logError(const char* command, uint16_t error) const;
+
+    TwoWire* _wire;
+    I2cMux* _mux;
+    uint8_t _channel;
+    SensirionI2CSen5x _driver;
+    Sen5xReader _reader;
+    char _serialNumber[32];
+    // major.minor
+    char _hwVersion[8];
+    char _swVersion[8];
+};
 
 #endif
\ No newline at end of file
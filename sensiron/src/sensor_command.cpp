@@ -0,0 +1,80 @@
+#include <ArduinoJson.h>
+#include <type_traits>
+#include "sensor_command.h"
+
+// Checks an optional numeric key, value is only written when it is present
+// and within [min, max]. Integer settings take integers only, a fraction is
+// an error rather than cut off.
+template <typename T>
+static bool readNumber(JsonDocument& doc, const char* key, double min, double max, T& value,
+                       char* error, size_t errorSize) {
+    JsonVariant variant = doc[key];
+    if (variant.isNull()) {
+        return true;
+    }
+    if (!variant.is<double>()) {
+        snprintf(error, errorSize, "%s is not a number", key);
+        return false;
+    }
+    double number = variant.as<double>();
+    if (number < min || number > max) {
+        snprintf(error, errorSize, "%s out of range", key);
+        return false;
+    }
+    if (std::is_integral<T>::value && !variant.is<T>()) {
+        snprintf(error, errorSize, "%s is not an integer", key);
+        return false;
+    }
+    value = (T) number;
+    return true;
+}
+
+bool parseTuningCommand(const char* payload, size_t length, Sen5xTuning& tuning,
+                        char* id, size_t idSize, char* error, size_t errorSize) {
+    JsonDocument doc;
+    Sen5xTuning parsed = tuning;
+
+    DeserializationError result = deserializeJson(doc, payload, length);
+    if (result) {
+        snprintf(error, errorSize, "invalid json: %s", result.c_str());
+        return false;
+    }
+    if (!doc.is<JsonObject>()) {
+        snprintf(error, errorSize, "not a json object");
+        return false;
+    }
+    snprintf(id, idSize, "%s", doc["id"] | "");
+
+    bool ok = readNumber(doc, "temperatureOffset", -50, 50, parsed.temperatureOffset, error, errorSize) &&
+              readNumber(doc, "temperatureSlope", -1, 1, parsed.temperatureSlope, error, errorSize) &&
+              readNumber(doc, "temperatureTimeConstant", 0, 65535, parsed.temperatureTimeConstant, error, errorSize) &&
+              readNumber(doc, "warmStart", 0, 65535, parsed.warmStart, error, errorSize) &&
+              readNumber(doc, "rhtAcceleration", SEN5X_RHT_ACCELERATION_LOW, SEN5X_RHT_ACCELERATION_MEDIUM,
+                         parsed.rhtAcceleration, error, errorSize) &&
+              readNumber(doc, "fanCleaningInterval", 0, 4294967295.0, parsed.fanCleaningInterval, error, errorSize);
+    if (ok) {
+        tuning = parsed;
+    }
+    return ok;
+}
+
+size_t formatCommandResult(char* buf, size_t size, const char* id, const char* error, const Sen5xTuning& tuning) {
+    JsonDocument doc;
+
+    doc["id"] = id;
+    doc["ok"] = error == nullptr;
+    if (error) {
+        doc["error"] = error;
+    } else {
+        doc["temperatureOffset"] = tuning.temperatureOffset;
+        doc["temperatureSlope"] = tuning.temperatureSlope;
+        doc["temperatureTimeConstant"] = tuning.temperatureTimeConstant;
+        doc["warmStart"] = tuning.warmStart;
+        doc["rhtAcceleration"] = tuning.rhtAcceleration;
+        doc["fanCleaningInterval"] = tuning.fanCleaningInterval;
+    }
+    if (measureJson(doc) >= size) {
+        return 0;
+    }
+    return serializeJson(doc, buf, size);
+}
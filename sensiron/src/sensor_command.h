@@ -0,0 +1,27 @@
+#ifndef SENSOR_COMMAND_H
+#define SENSOR_COMMAND_H
+#include <stddef.h>
+
+#include "sensirion.h"
+
+// Commands on <stateTopic>/set reconfigure the sensor, a json object with any
+// of these keys:
+//   temperatureOffset        degC, -50 to 50
+//   temperatureSlope         -1 to 1
+//   temperatureTimeConstant  seconds, 0 to 65535
+//   warmStart                0 to 65535
+//   rhtAcceleration          0 low, 1 high, 2 medium
+//   fanCleaningInterval      seconds, 0 disables
+//   id                       echoed in the result, up to 32 characters
+// The result is published on <stateTopic>/set/result.
+
+// Applies the keys present in the payload to tuning. Returns false with the
+// reason in error when the payload is not valid, tuning is unchanged then.
+bool parseTuningCommand(const char* payload, size_t length, Sen5xTuning& tuning,
+                        char* id, size_t idSize, char* error, size_t errorSize);
+
+// The result document: the id, "ok" and either the tuning in effect or the
+// error. Returns the length written, 0 if buf is too small.
+size_t formatCommandResult(char* buf, size_t size, const char* id, const char* error, const Sen5xTuning& tuning);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SENSOR_FIELDS_H
+#define SENSOR_FIELDS_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "measurement.h"
+
+// Describes one published value of the sensor. The state document, the home
+// assistant discovery messages and the settings are all generated from
+// SENSOR_DESCRIPTORS, adding a field is one line in the table.
+struct SensorDescriptor {
+    SensorField field;
+    const char* key;            // Key in the json state document.
+    const char* name;           // Appended to the entity name.
+    const char* topic;          // Discovery topic component.
+    const char* unit;
+    int8_t precision;           // Suggested display precision, -1 for none.
+    const char* uniqueIdSuffix;
+};
+
+// The units are the ones published since the first release. Home assistant
+// keeps long term statistics per unit, changing one breaks the statistics of
+// every existing install.
+constexpr SensorDescriptor SENSOR_DESCRIPTORS[] = {
+    {SensorField::Pm1p0, "pm1p0", "Pm1p0", "pm1p0", "μg/mᵌ", 2, "pm1p0"},
+    {SensorField::Pm2p5, "pm2p5", "Pm2p5", "pm2p5", "μg/mᵌ", 2, "pm2p5"},
+    {SensorField::Pm4p0, "pm4p0", "Pm4p0", "pm4p0", "μg/mᵌ", 2, "pm4p0"},
+    {SensorField::Pm10p0, "pm10p0", "Pm10p0", "pm10p0", "μg/mᵌ", 2, "pm10p0"},
+    {SensorField::Temperature, "temperature", "Temperature", "temperature", "⁰C", 2, "temp"},
+    {SensorField::Humidity, "humidity", "Humidity", "humidity", "%RH", 2, "humid"},
+    {SensorField::VocIndex, "vocIndex", "VocIndex", "vocindex", "", -1, "voci"},
+    {SensorField::NoxIndex, "noxIndex", "NoxIndex", "noxindex", "", -1, "noxi"},
+};
+
+constexpr size_t SENSOR_DESCRIPTOR_COUNT = sizeof(SENSOR_DESCRIPTORS) / sizeof(SENSOR_DESCRIPTORS[0]);
+
+#endif
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "log.h"
+#include "metrics.h"
+#include "sensor_fields.h"
+#include "sensor_pipeline.h"
+
+static int clampSetting(int value, int low, int high) {
+    return value < low ? low : value > high ? high : value;
+}
+
+SensorPipeline::SensorPipeline(Clock& clock, MqttClient& client, SensorChannel* channels, size_t count,
+                               SampleListener& listener)
+    : _clock(clock), _client(client), _connection(client, clock), _channels(channels), _count(count),
+      _listener(listener), _scheduler(10000, count), _stateCache("{}"), _sampleBuffer(SAMPLE_BUFFER_POLICY)
+#ifdef SAMPLE_SPILL_ENABLED
+      , _sampleSpill("/spill.bin", sizeof(TimedMeasurement), SAMPLE_SPILL_MAX_RECORDS)
+#endif
+{
+    _activeSensor = -1;
+    _readStarted = 0;
+    _stateTopic[0] = '\0';
+    _commandStateTopic[0] = '\0';
+    _mqttServer[0] = '\0';
+    _mqttPort = 1883;
+    _mqttEnabled = false;
+    _batchSize = 0;
+    _batchEncoding = BatchEncoding::Binary;
+    _chipId = 0;
+    _discoveryCheck = false;
+    _discoveryForce = false;
+    _discoveryHash = 0;
+    _previousReplay = 0;
+    _previousMetrics = 0;
+}
+
+void SensorPipeline::begin() {
+#ifdef SAMPLE_SPILL_ENABLED
+    _sampleSpill.begin();
+#endif
+}
+
+void SensorPipeline::applySettings(const Settings& settings) {
+    snprintf(_stateTopic, sizeof(_stateTopic), "%s", settings.stateTopic);
+    snprintf(_mqttServer, sizeof(_mqttServer), "%s", settings.mqttServer);
+    _mqttPort = settings.mqttPort;
+    _mqttEnabled = settings.mqttEnabled;
+    _scheduler.setPublishInterval(
+        clampSetting(settings.publishInterval, PUBLISH_INTERVAL_MIN, PUBLISH_INTERVAL_MAX) * 1000UL);
+    // The report filter settings are the same for every sensor.
+    unsigned long heartbeat = clampSetting((int) settings.heartbeat, HEARTBEAT_MIN, HEARTBEAT_MAX) * 1000UL;
+    for (size_t sensor = 0; sensor < _count; sensor++) {
+        ReportFilter& reportFilter = _channels[sensor].reportFilter;
+        reportFilter.setHeartbeat(heartbeat);
+        for (const SensorDescriptor& descriptor : SENSOR_DESCRIPTORS) {
+            Deadband deadband;
+            deadband.threshold = settings.deadbandThreshold[(size_t) descriptor.field];
+            deadband.relative = settings.deadbandRelative[(size_t) descriptor.field];
+            reportFilter.setDeadband(descriptor.field, deadband);
+        }
+    }
+    _batchSize = clampSetting(settings.batchSize, 0, SAMPLE_BATCH_CAPACITY);
+    _batchEncoding = (BatchEncoding) clampSetting(settings.batchEncoding, 0, (int) BatchEncoding::Binary);
+}
+
+void SensorPipeline::captureSettings(Settings& settings) const {
+    const ReportFilter& reportFilter = _channels[0].reportFilter;
+
+    snprintf(settings.stateTopic, sizeof(settings.stateTopic), "%s", _stateTopic);
+    snprintf(settings.mqttServer, sizeof(settings.mqttServer), "%s", _mqttServer);
+    settings.mqttPort = _mqttPort;
+    settings.mqttEnabled = _mqttEnabled;
+    settings.publishInterval = _scheduler.publishInterval() / 1000;
+    settings.heartbeat = reportFilter.heartbeat() / 1000;
+    for (const SensorDescriptor& descriptor : SENSOR_DESCRIPTORS) {
+        const Deadband& deadband = reportFilter.deadband(descriptor.field);
+        settings.deadbandThreshold[(size_t) descriptor.field] = deadband.threshold;
+        settings.deadbandRelative[(size_t) descriptor.field] = deadband.relative;
+    }
+    settings.batchSize = _batchSize;
+    settings.batchEncoding = (uint8_t) _batchEncoding;
+}
+
+// Reads the sensor whose turn it is and closes the publish windows.
+void SensorPipeline::sample(unsigned long now) {
+    SensirionMeasurement data;
+
+    if (_activeSensor < 0) {
+        int next = _scheduler.nextPoll(now);
+        if (next >= 0 && _channels[next].sensor->beginRead(now)) {
+            _activeSensor = next;
+            _readStarted = now;
+        }
+    }
+    if (_activeSensor >= 0) {
+        Sen5xReadResult result = _channels[_activeSensor].sensor->pollRead(now, data);
+        if (result == Sen5xReadResult::Sample) {
+            _scheduler.sampleTaken(_activeSensor, _readStarted);
+            _channels[_activeSensor].window.add(data);
+            _listener.sampleRead(_activeSensor, now, data);
+        }
+        if (result != Sen5xReadResult::Pending) {
+            _activeSensor = -1;
+        }
+    }
+
+    if (!_scheduler.publishDue(now)) {
+        return;
+    }
+    for (size_t sensor = 0; sensor < _count; sensor++) {
+        MeasurementAggregator& window = _channels[sensor].window;
+        if (window.count() == 0) {
+            continue;
+        }
+        _listener.windowClosed(sensor, now, window);
+        window.reset();
+    }
+}
+
+unsigned long SensorPipeline::idleTime(unsigned long now) const {
+    unsigned long idle = _scheduler.idleTime(now);
+    // Read once, the sampling task may change it.
+    int sensor = _activeSensor;
+
+    if (sensor >= 0 && _channels[sensor].sensor->readIdleTime(now) < idle) {
+        idle = _channels[sensor].sensor->readIdleTime(now);
+    }
+    return idle;
+}
+
+void SensorPipeline::loop(unsigned long now) {
+    if (!_mqttEnabled) {
+        if (_connection.connected()) {
+            _connection.disconnect();
+        }
+        return;
+    }
+
+    // Picks up changes from the settings page, reconnects if needed.
+    _connection.setServer(_mqttServer, _mqttPort);
+    bool reconnected = _connection.loop(now);
+    if (reconnected) {
+        _discoveryCheck = true;
+    }
+    if (!_connection.connected()) {
+        return;
+    }
+    subscribeCommands(reconnected);
+    if (_discoveryCheck || _discoveryForce) {
+        bool force = _discoveryForce;
+        _discoveryCheck = false;
+        _discoveryForce = false;
+        publishDiscovery(force);
+    }
+    replayBuffered(now);
+    publishMetrics(now);
+}
+
+bool SensorPipeline::publish(const char* topic, const char* payload, size_t length, bool retained) {
+    uint32_t start = _clock.micros();
+    bool ok = _client.publish(topic, (const uint8_t*) payload, length, retained);
+    metrics.mqttPublish.observe(_clock.micros() - start);
+    if (ok) {
+        metrics.mqttPublishes++;
+    } else {
+        metrics.mqttPublishFailures++;
+    }
+    LOG_DEBUG("Published %u bytes to %s", (unsigned) length, topic);
+    return ok;
+}
+
+// The topic of sensor followed by /suffix when one is given. Sensor 0 uses
+// the state topic, sensor n <stateTopic>/<n>.
+void SensorPipeline::sensorTopic(size_t sensor, const char* suffix, char* buf, size_t size) const {
+    char index[8] = "";
+
+    if (sensor > 0) {
+        snprintf(index, sizeof(index), "/%u", (unsigned) sensor);
+    }
+    snprintf(buf, size, "%s%s%s%s", _stateTopic, index, suffix ? "/" : "", suffix ? suffix : "");
+}
+
+void SensorPipeline::bufferMeasurement(size_t sensor, const SensirionMeasurement& data, uint32_t timestamp) {
+    TimedMeasurement sample;
+    TimedMeasurement evicted;
+
+    sample.timestamp = timestamp;
+    sample.sensor = sensor;
+    sample.data = data;
+    if (_sampleBuffer.push(sample, &evicted)) {
+#ifdef SAMPLE_SPILL_ENABLED
+        _sampleSpill.append(&evicted);
+#endif
+    }
+}
+
+// The oldest buffered sample, it stays buffered until it is popped.
+bool SensorPipeline::peekBufferedMeasurement(TimedMeasurement& sample) {
+#ifdef SAMPLE_SPILL_ENABLED
+    // The spill file holds the samples evicted from RAM, they are the oldest.
+    if (_sampleSpill.peek(&sample)) {
+        return true;
+    }
+#endif
+    if (_sampleBuffer.empty()) {
+        return false;
+    }
+    sample = _sampleBuffer.peek();
+    return true;
+}
+
+void SensorPipeline::popBufferedMeasurement() {
+#ifdef SAMPLE_SPILL_ENABLED
+    if (_sampleSpill.pending() > 0) {
+        _sampleSpill.pop();
+        return;
+    }
+#endif
+    _sampleBuffer.pop();
+}
+
+// Replays samples buffered during a broker outage to <sensor topic>/replay,
+// oldest first and rate limited so a fleet reconnecting does not flood the
+// broker. "age" is the number of seconds since the sample was taken. A
+// sample leaves the buffer once it was published, the batch stops at the
+// first failure and is retried on the next interval.
+void SensorPipeline::replayBuffered(unsigned long now) {
+    TimedMeasurement sample;
+
+    if (now - _previousReplay < REPLAY_INTERVAL_MS) {
+        return;
+    }
+    _previousReplay = now;
+
+    char topic[128];
+    for (int i = 0; i < REPLAY_BATCH_SIZE && peekBufferedMeasurement(sample); i++) {
+        sensorTopic(sample.sensor < _count ? sample.sensor : 0, "replay", topic, sizeof(topic));
+        size_t n = formatMeasurement(_publishBuffer, sizeof(_publishBuffer), sample.data,
+                                     now / 1000 - sample.timestamp);
+        if (!publish(topic, _publishBuffer, n)) {
+            break;
+        }
+        popBufferedMeasurement();
+    }
+}
+
+void SensorPipeline::publishMetrics(unsigned long now) {
+#if METRICS_PUBLISH_INTERVAL_MS > 0
+    char topic[128];
+
+    if (now - _previousMetrics < METRICS_PUBLISH_INTERVAL_MS) {
+        return;
+    }
+    _previousMetrics = now;
+
+    size_t n = formatMetricsJson(metrics, _publishBuffer, sizeof(_publishBuffer));
+    snprintf(topic, sizeof(topic), "%s/diagnostics", _stateTopic);
+    if (n) {
+        publish(topic, _publishBuffer, n);
+    }
+#else
+    (void) now;
+#endif
+}
+
+// Publishes the batch of sensor to <sensor topic>/batch. When the broker is
+// unreachable the samples move to the replay buffer and go out one by one
+// later.
+void SensorPipeline::publishBatch(size_t sensor, unsigned long now) {
+    BENCH_SCOPE("publishBatch");
+    SampleBatch& batch = _channels[sensor].batch;
+    char topic[128];
+    size_t n = 0;
+
+    sensorTopic(sensor, "batch", topic, sizeof(topic));
+    if (_connection.connected()) {
+        n = batch.encode(_batchEncoding, now / 1000, _batchPayload, sizeof(_batchPayload));
+    }
+    if (!n || !publish(topic, (const char*) _batchPayload, n)) {
+        for (size_t i = 0; i < batch.size(); i++) {
+            bufferMeasurement(sensor, batch.sample(i), batch.timestamp(i));
+        }
+    }
+    batch.clear();
+}
+
+// Publishes the window of sensor that was closed at now.
+void SensorPipeline::publishWindow(size_t sensor, const MeasurementAggregator& window, unsigned long now) {
+    BENCH_SCOPE("publishWindow");
+    SensorChannel& channel = _channels[sensor];
+    const char* payload = _publishBuffer;
+    char topic[128];
+
+    // Only the first sensor is kept for /data.
+    size_t length;
+    if (sensor == 0) {
+        length = formatWindow(_stateCache.back(), _stateCache.capacity(), window);
+        if (length) {
+            _stateCache.commit(length);
+        }
+        payload = _stateCache.front();
+        length = _stateCache.length();
+    } else {
+        length = formatWindow(_publishBuffer, sizeof(_publishBuffer), window);
+    }
+
+    SensirionMeasurement mean = window.mean();
+    if (_mqttEnabled && channel.reportFilter.shouldPublish(mean, now)) {
+        if (_batchSize > 0) {
+            channel.batch.add(now / 1000, mean);
+        } else if (_connection.connected()) {
+            sensorTopic(sensor, nullptr, topic, sizeof(topic));
+            if (length) {
+                publish(topic, payload, length);
+            }
+        } else {
+            bufferMeasurement(sensor, mean, now / 1000);
+        }
+        channel.reportFilter.published(mean, now);
+    } else if (_mqttEnabled) {
+        metrics.publishesSuppressed++;
+    }
+
+    // A partly filled batch goes out after a heartbeat at the latest.
+    if (!channel.batch.empty() &&
+        (channel.batch.size() >= (size_t) _batchSize ||
+         now / 1000 - channel.batch.timestamp(0) >= channel.reportFilter.heartbeat() / 1000)) {
+        publishBatch(sensor, now);
+    }
+}
+
+// Subscribes <stateTopic>/set after a (re)connect and when the state topic
+// changed on the settings page.
+void SensorPipeline::subscribeCommands(bool reconnected) {
+    char topic[128];
+
+    if (!reconnected && strcmp(_commandStateTopic, _stateTopic) == 0) {
+        return;
+    }
+    if (!reconnected && _commandStateTopic[0]) {
+        snprintf(topic, sizeof(topic), "%s/set", _commandStateTopic);
+        _client.unsubscribe(topic);
+    }
+    snprintf(topic, sizeof(topic), "%s/set", _stateTopic);
+    if (_client.subscribe(topic)) {
+        snprintf(_commandStateTopic, sizeof(_commandStateTopic), "%s", _stateTopic);
+    } else {
+        _commandStateTopic[0] = '\0';
+    }
+}
+
+void SensorPipeline::requestDiscovery(bool force) {
+    if (force) {
+        _discoveryForce = true;
+    } else {
+        _discoveryCheck = true;
+    }
+}
+
+// Discovery of one sensor, every sensor is a device of its own.
+HaDiscovery SensorPipeline::sensorDiscovery(size_t sensor) const {
+    char topic[128];
+    const Sensor& device = *_channels[sensor].sensor;
+
+    sensorTopic(sensor, nullptr, topic, sizeof(topic));
+    HaDiscovery ha_discovery(topic, _chipId, sensor);
+    ha_discovery.setDeviceInfo(device.serialNumber(), device.hwVersion(), device.swVersion());
+    return ha_discovery;
+}
+
+// Discovery messages are published retained, so they only need to be sent
+// again when the generated config changes. The hash of the last config that
+// was published successfully is kept by the caller.
+void SensorPipeline::publishDiscovery(bool force) {
+    BENCH_SCOPE("publishDiscovery");
+    char topic[128];
+
+    uint32_t hash = HA_DISCOVERY_HASH_INIT;
+    for (size_t sensor = 0; sensor < _count; sensor++) {
+        hash = sensorDiscovery(sensor).getConfigHash(_publishBuffer, sizeof(_publishBuffer), hash);
+    }
+    if (!force && _discoveryHash == hash) {
+        LOG_DEBUG("Discovery config unchanged");
+        return;
+    }
+
+    bool ok = true;
+    for (size_t sensor = 0; sensor < _count; sensor++) {
+        HaDiscovery ha_discovery = sensorDiscovery(sensor);
+        for (size_t i = 0; i < ha_discovery.count(); i++) {
+            size_t n = ha_discovery.getDiscoveryMsg(i, _publishBuffer, sizeof(_publishBuffer));
+            if (n && ha_discovery.getDiscoveryTopic(i, topic, sizeof(topic))) {
+                ok = publish(topic, _publishBuffer, n, true) && ok;
+            } else {
+                ok = false;
+            }
+        }
+    }
+    if (ok) {
+        _discoveryHash = hash;
+    }
+}
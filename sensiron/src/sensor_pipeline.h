@@ -0,0 +1,185 @@
+#ifndef SENSOR_PIPELINE_H
+#define SENSOR_PIPELINE_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ha_discovery.h"
+#include "measurement_aggregator.h"
+#include "mqtt_connection.h"
+#include "pipeline_io.h"
+#include "report_filter.h"
+#include "response_cache.h"
+#include "ring_buffer.h"
+#include "sample_batch.h"
+#include "sampling_scheduler.h"
+#include "settings.h"
+#include "state_payload.h"
+#ifdef SAMPLE_SPILL_ENABLED
+#include "sample_spill.h"
+#endif
+
+// Store and forward of samples taken while the broker is unreachable, all of
+// these can be overridden with build flags.
+#ifndef SAMPLE_BUFFER_CAPACITY
+#define SAMPLE_BUFFER_CAPACITY 64
+#endif
+#ifndef SAMPLE_BUFFER_POLICY
+#define SAMPLE_BUFFER_POLICY DropPolicy::DropOldest
+#endif
+#ifndef SAMPLE_SPILL_MAX_RECORDS
+#define SAMPLE_SPILL_MAX_RECORDS 2048
+#endif
+// Publish a metrics summary to <stateTopic>/diagnostics this often, 0 disables it.
+#ifndef METRICS_PUBLISH_INTERVAL_MS
+#define METRICS_PUBLISH_INTERVAL_MS 0
+#endif
+// Buffered samples are replayed at most REPLAY_BATCH_SIZE per REPLAY_INTERVAL_MS.
+#ifndef REPLAY_BATCH_SIZE
+#define REPLAY_BATCH_SIZE 4
+#endif
+#ifndef REPLAY_INTERVAL_MS
+#define REPLAY_INTERVAL_MS 1000
+#endif
+
+struct TimedMeasurement {
+    uint32_t timestamp; // Seconds since boot.
+    uint8_t sensor;
+    SensirionMeasurement data;
+};
+
+// A sensor and its publish pipeline.
+struct SensorChannel {
+    Sensor* sensor = nullptr;
+    // Statistics of the samples read since the last publish.
+    MeasurementAggregator window;
+    // Only publish when a value changed past its deadband or on the heartbeat.
+    ReportFilter reportFilter = ReportFilter(300000);
+    // Samples collected for the next batch message, batchSize 0 publishes
+    // every window on the state topic instead.
+    SampleBatch batch;
+};
+
+// Receives what the sampling side produces, called from sample().
+class SampleListener {
+public:
+    virtual ~SampleListener() {}
+
+    virtual void sampleRead(size_t sensor, unsigned long now, const SensirionMeasurement& data) = 0;
+    // The window is reset after the call, publishWindow() it from the
+    // network side.
+    virtual void windowClosed(size_t sensor, unsigned long now, const MeasurementAggregator& window) = 0;
+};
+
+// The sampling and publish pipeline of the firmware. It only talks to the
+// platform through pipeline_io.h, so the native simulation runs this code on
+// its fake clock, broker and sensor.
+//
+// The sampling side, sample(), reads the sensors in turn and closes the
+// publish windows. On the ESP32 it runs in a task of its own. The network
+// side, loop() and publishWindow(), keeps the MQTT connection, publishes
+// the windows and replays the samples buffered while the broker was
+// unreachable.
+class SensorPipeline {
+public:
+    SensorPipeline(Clock& clock, MqttClient& client, SensorChannel* channels, size_t count,
+                   SampleListener& listener);
+
+    void begin();
+    // Identity on the broker and in the discovery ids.
+    void setClientId(const char* clientId) { _connection.setClientId(clientId); }
+    void setChipId(uint32_t chipId) { _chipId = chipId; }
+
+    // Takes the MQTT, publish and report filter settings, the rest is left
+    // to the caller. captureSettings() writes the same fields back.
+    void applySettings(const Settings& settings);
+    void captureSettings(Settings& settings) const;
+
+    // Sampling side. A read is split over several calls so the sensor's
+    // execution times are not spent blocking.
+    void sample(unsigned long now);
+    // True while a read is in progress, other commands wait for the end.
+    bool reading() const { return _activeSensor >= 0; }
+    // Milliseconds until sample() has something to do.
+    unsigned long idleTime(unsigned long now) const;
+
+    // Network side.
+    void loop(unsigned long now);
+    void publishWindow(size_t sensor, const MeasurementAggregator& window, unsigned long now);
+    bool publish(const char* topic, const char* payload, size_t length, bool retained = false);
+    // The discovery messages are checked on the next loop(), force sends
+    // them even when they did not change.
+    void requestDiscovery(bool force);
+    // Hash of the discovery config published last, kept across restarts by
+    // the caller.
+    uint32_t discoveryHash() const { return _discoveryHash; }
+    void setDiscoveryHash(uint32_t hash) { _discoveryHash = hash; }
+
+    const char* stateTopic() const { return _stateTopic; }
+    const char* mqttServer() const { return _mqttServer; }
+    uint16_t mqttPort() const { return _mqttPort; }
+    bool mqttEnabled() const { return _mqttEnabled; }
+    int batchSize() const { return _batchSize; }
+    BatchEncoding batchEncoding() const { return _batchEncoding; }
+
+    SamplingScheduler& scheduler() { return _scheduler; }
+    MqttConnection& connection() { return _connection; }
+    // Latest state document of the first sensor, served on /data.
+    ResponseCache<STATE_PAYLOAD_SIZE>& stateCache() { return _stateCache; }
+    const RingBuffer<TimedMeasurement, SAMPLE_BUFFER_CAPACITY>& sampleBuffer() const { return _sampleBuffer; }
+    // Shared by the publishes that need formatting, free while the client
+    // delivers a message.
+    char* publishBuffer() { return _publishBuffer; }
+    size_t publishBufferSize() const { return sizeof(_publishBuffer); }
+
+private:
+    void sensorTopic(size_t sensor, const char* suffix, char* buf, size_t size) const;
+    void bufferMeasurement(size_t sensor, const SensirionMeasurement& data, uint32_t timestamp);
+    bool peekBufferedMeasurement(TimedMeasurement& sample);
+    void popBufferedMeasurement();
+    void replayBuffered(unsigned long now);
+    void publishMetrics(unsigned long now);
+    void publishBatch(size_t sensor, unsigned long now);
+    void subscribeCommands(bool reconnected);
+    HaDiscovery sensorDiscovery(size_t sensor) const;
+    void publishDiscovery(bool force);
+
+    Clock& _clock;
+    MqttClient& _client;
+    MqttConnection _connection;
+    SensorChannel* _channels;
+    size_t _count;
+    SampleListener& _listener;
+    SamplingScheduler _scheduler;
+
+    // Sensor with a read in progress and when it started, -1 for none.
+    int _activeSensor;
+    unsigned long _readStarted;
+
+    char _stateTopic[sizeof(Settings::stateTopic)];
+    // State topic of the subscribed command topic, empty when not subscribed.
+    char _commandStateTopic[sizeof(Settings::stateTopic)];
+    char _mqttServer[sizeof(Settings::mqttServer)];
+    uint16_t _mqttPort;
+    bool _mqttEnabled;
+    int _batchSize;
+    BatchEncoding _batchEncoding;
+    uint32_t _chipId;
+    // Set from the web handlers, discovery is (re)published from loop().
+    volatile bool _discoveryCheck;
+    volatile bool _discoveryForce;
+    uint32_t _discoveryHash;
+    unsigned long _previousReplay;
+    unsigned long _previousMetrics;
+
+    // Requests copy the front buffer while the next document is rendered
+    // into the back one.
+    ResponseCache<STATE_PAYLOAD_SIZE> _stateCache;
+    // Sized like the mqtt buffer.
+    char _publishBuffer[512];
+    uint8_t _batchPayload[SAMPLE_BATCH_PAYLOAD_SIZE];
+    RingBuffer<TimedMeasurement, SAMPLE_BUFFER_CAPACITY> _sampleBuffer;
+#ifdef SAMPLE_SPILL_ENABLED
+    SampleSpill _sampleSpill;
+#endif
+};
+#endif
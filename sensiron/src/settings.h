@@ -0,0 +1,37 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+#include <stdint.h>
+
+#include "measurement.h"
+
+// All persisted configuration. Laid out without padding, largest members
+// first, so two copies can be compared and checksummed byte for byte.
+struct Settings {
+    uint32_t heartbeat;                // s
+    uint32_t fanCleaningInterval;      // s
+    float deadbandThreshold[SENSOR_FIELD_COUNT];
+    float temperatureOffset;
+    float temperatureSlope;
+    uint16_t mqttPort;
+    uint16_t publishInterval;          // s
+    uint16_t temperatureTimeConstant;  // s
+    uint16_t warmStart;
+    uint16_t rhtAcceleration;
+    uint8_t mqttEnabled;
+    uint8_t deadbandRelative[SENSOR_FIELD_COUNT];
+    uint8_t batchSize;
+    uint8_t batchEncoding;
+    uint8_t powerMode;
+    char stateTopic[96];
+    char mqttServer[64];
+    uint8_t reserved[2];
+};
+
+static_assert(sizeof(Settings) == 232, "Settings must not contain padding");
+
+// Limits for the publish interval and the heartbeat in seconds.
+const int PUBLISH_INTERVAL_MIN = 1;
+const int PUBLISH_INTERVAL_MAX = 3600;
+const int HEARTBEAT_MIN = 10;
+const int HEARTBEAT_MAX = 86400;
+#endif
@@ -0,0 +1,156 @@
+#include <string.h>
+#include "log.h"
+#include "sample_batch.h"
+#include "sensirion.h"
+#include "settings_store.h"
+
+static const char* SETTINGS_KEY = "settings";
+
+// Stored in front of the settings.
+struct SettingsHeader {
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t size;
+    uint32_t crc;
+};
+
+// CRC-32 (IEEE), bitwise, the blob is only checked at boot.
+static uint32_t crc32(const uint8_t* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (length--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+void settingsDefaults(Settings& settings) {
+    memset(&settings, 0, sizeof(settings));
+    settings.heartbeat = 300;
+    settings.fanCleaningInterval = SEN5X_FAN_CLEANING_INTERVAL_DEFAULT;
+    settings.mqttPort = 1883;
+    settings.publishInterval = 10;
+    settings.rhtAcceleration = SEN5X_RHT_ACCELERATION_LOW;
+    settings.mqttEnabled = 1;
+    settings.batchEncoding = (uint8_t) BatchEncoding::Binary;
+    strncpy(settings.stateTopic, "environment/sensirion", sizeof(settings.stateTopic) - 1);
+    strncpy(settings.mqttServer, "192.168.1.10", sizeof(settings.mqttServer) - 1);
+}
+
+SettingsStore::SettingsStore(Preferences& prefs)
+    : _prefs(prefs), _changedAt(0), _dirty(false), _migrated(false), _writes(0) {
+    settingsDefaults(_settings);
+    _persisted = _settings;
+}
+
+bool SettingsStore::begin() {
+    if (load(_settings)) {
+        _persisted = _settings;
+        return true;
+    }
+
+    settingsDefaults(_settings);
+    _migrated = migrate(_settings);
+    // Nothing valid is stored, write what we have on the first loop().
+    memset(&_persisted, 0xFF, sizeof(_persisted));
+    _dirty = true;
+    _changedAt = millis() - SETTINGS_COMMIT_DELAY_MS;
+    return _migrated;
+}
+
+void SettingsStore::update(const Settings& settings, unsigned long now) {
+    _settings = settings;
+    // Strings are compared including the bytes after the terminator.
+    _settings.stateTopic[sizeof(_settings.stateTopic) - 1] = 0;
+    _settings.mqttServer[sizeof(_settings.mqttServer) - 1] = 0;
+    _settings.reserved[0] = 0;
+    _settings.reserved[1] = 0;
+    _dirty = memcmp(&_settings, &_persisted, sizeof(Settings)) != 0;
+    _changedAt = now;
+}
+
+void SettingsStore::loop(unsigned long now) {
+    if (!_dirty || now - _changedAt < SETTINGS_COMMIT_DELAY_MS) {
+        return;
+    }
+    if (commit()) {
+        _persisted = _settings;
+        _dirty = false;
+        if (_migrated) {
+            removeLegacyKeys();
+            _migrated = false;
+        }
+    } else {
+        // Retry after another delay instead of on every loop.
+        _changedAt = now;
+    }
+}
+
+bool SettingsStore::commit() {
+    uint8_t blob[sizeof(SettingsHeader) + sizeof(Settings)];
+    SettingsHeader header = {SETTINGS_VERSION, 0, sizeof(Settings),
+                             crc32((const uint8_t*) &_settings, sizeof(Settings))};
+
+    memcpy(blob, &header, sizeof(header));
+    memcpy(blob + sizeof(header), &_settings, sizeof(Settings));
+    if (_prefs.putBytes(SETTINGS_KEY, blob, sizeof(blob)) != sizeof(blob)) {
+        LOG_ERROR("Writing the settings failed");
+        return false;
+    }
+    _writes++;
+    LOG_INFO("Settings saved");
+    return true;
+}
+
+bool SettingsStore::load(Settings& settings) {
+    uint8_t blob[sizeof(SettingsHeader) + sizeof(Settings)];
+    SettingsHeader header;
+
+    if (!_prefs.isKey(SETTINGS_KEY)) {
+        return false;
+    }
+    if (_prefs.getBytes(SETTINGS_KEY, blob, sizeof(blob)) != sizeof(blob)) {
+        LOG_ERROR("Stored settings have the wrong size, using defaults");
+        return false;
+    }
+    memcpy(&header, blob, sizeof(header));
+    memcpy(&settings, blob + sizeof(header), sizeof(Settings));
+    if (header.version != SETTINGS_VERSION || header.size != sizeof(Settings)) {
+        LOG_ERROR("Stored settings have version %u, expected %u, using defaults",
+                  header.version, SETTINGS_VERSION);
+        return false;
+    }
+    if (header.crc != crc32((const uint8_t*) &settings, sizeof(Settings))) {
+        LOG_ERROR("Stored settings are corrupted, using defaults");
+        return false;
+    }
+    return true;
+}
+
+// Keys used by the firmware before the settings blob.
+static const char* const LEGACY_KEYS[] = {
+    "mqttStateTopic", "mqttServerIp", "mqttServerPort", "mqttEnabled",
+};
+
+bool SettingsStore::migrate(Settings& settings) {
+    if (!_prefs.isKey("mqttStateTopic")) {
+        return false;
+    }
+    strncpy(settings.stateTopic, _prefs.getString("mqttStateTopic", settings.stateTopic).c_str(),
+            sizeof(settings.stateTopic) - 1);
+    strncpy(settings.mqttServer, _prefs.getString("mqttServerIp", settings.mqttServer).c_str(),
+            sizeof(settings.mqttServer) - 1);
+    settings.mqttPort = _prefs.getInt("mqttServerPort", settings.mqttPort);
+    settings.mqttEnabled = _prefs.getBool("mqttEnabled", settings.mqttEnabled);
+    LOG_INFO("Migrated settings from the previous format");
+    return true;
+}
+
+void SettingsStore::removeLegacyKeys() {
+    for (const char* key : LEGACY_KEYS) {
+        _prefs.remove(key);
+    }
+}
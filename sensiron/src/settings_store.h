@@ -0,0 +1,53 @@
+#ifndef SETTINGS_STORE_H
+#define SETTINGS_STORE_H
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include "settings.h"
+
+// Bumped when the layout of Settings changes, a blob with another version is
+// not loaded.
+#define SETTINGS_VERSION 1
+// A change is written once no other change came in for this long, so a form
+// submit or a burst of commands is one flash write.
+#ifndef SETTINGS_COMMIT_DELAY_MS
+#define SETTINGS_COMMIT_DELAY_MS 2000
+#endif
+
+void settingsDefaults(Settings& settings);
+
+// Keeps the settings in RAM and writes them to the preferences as one blob
+// with a version and a CRC, only when they differ from what is stored.
+class SettingsStore {
+public:
+    SettingsStore(Preferences& prefs);
+
+    // Loads the stored settings. Settings stored under the separate keys of
+    // older firmware are migrated. Returns false when nothing valid was
+    // stored, settings() holds the defaults then.
+    bool begin();
+    const Settings& settings() const { return _settings; }
+
+    // Takes the settings, they are written from loop() after the commit delay.
+    void update(const Settings& settings, unsigned long now);
+    void loop(unsigned long now);
+
+    bool pending() const { return _dirty; }
+    // Number of blob writes since boot.
+    uint32_t writes() const { return _writes; }
+
+private:
+    bool load(Settings& settings);
+    bool migrate(Settings& settings);
+    void removeLegacyKeys();
+    bool commit();
+
+    Preferences& _prefs;
+    Settings _settings;
+    Settings _persisted;
+    unsigned long _changedAt;
+    bool _dirty;
+    bool _migrated;
+    uint32_t _writes;
+};
+#endif
@@ -0,0 +1,58 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed capacity FIFO between exactly one producer and one consumer thread,
+// without locks. Each index is written by one side only, the release store
+// hands the slot over to the other side. The indices run freely and wrap, so
+// Capacity must be a power of two. Kept free of Arduino dependencies so it
+// can be built on the host.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    SpscQueue() : _head(0), _tail(0), _dropped(0) {}
+
+    // Producer side. Returns false and counts the item as dropped when the
+    // queue is full, the producer never waits for the consumer.
+    bool push(const T& item) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == Capacity) {
+            _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        _items[tail & (Capacity - 1)] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side.
+    bool pop(T& item) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = _items[head & (Capacity - 1)];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side, exact only on the consumer side.
+    size_t size() const {
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return Capacity; }
+    // Number of items refused by push() since boot.
+    uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+    T _items[Capacity];
+    std::atomic<size_t> _head;
+    std::atomic<size_t> _tail;
+    std::atomic<uint32_t> _dropped;
+};
+#endif
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include "sensor_fields.h"
+#include "state_payload.h"
+
+// Appends text to buf, returns false if it does not fit.
+static bool append(char* buf, size_t size, size_t& pos, const char* format, const char* text, long value = 0) {
+    int n = snprintf(buf + pos, size - pos, format, text, value);
+    if (n < 0 || (size_t) n >= size - pos) {
+        return false;
+    }
+    pos += n;
+    return true;
+}
+
+// Appends the value of field in the sensor's resolution followed by a comma,
+// null when the sensor reports it as unknown. Returns false if buf is full.
+static bool appendValue(char* buf, size_t size, size_t& pos, const SensirionMeasurement& data, SensorField field) {
+    if (!data.known(field)) {
+        return append(buf, size, pos, "%snull,", "");
+    }
+
+    // Smallest power of ten the scale divides, 200 prints with 3 decimals.
+    int scale = SensirionMeasurement::scale(field);
+    int32_t divisor = 1;
+    int decimals = 0;
+    while (divisor < scale) {
+        divisor *= 10;
+        decimals++;
+    }
+    int32_t scaled = data.raw(field) * (divisor / scale);
+    const char* sign = scaled < 0 ? "-" : "";
+    if (scaled < 0) {
+        scaled = -scaled;
+    }
+    int n = snprintf(buf + pos, size - pos, "%s%ld.%0*ld,", sign,
+                     (long) (scaled / divisor), decimals, (long) (scaled % divisor));
+    if (n < 0 || (size_t) n >= size - pos) {
+        return false;
+    }
+    pos += n;
+    return true;
+}
+
+// Same as appendValue for a float, rounded to the sensor's resolution.
+static bool appendValue(char* buf, size_t size, size_t& pos, float value, SensorField field) {
+    SensirionMeasurement data;
+
+    data.setValue(field, value);
+    return appendValue(buf, size, pos, data, field);
+}
+
+// Replaces the trailing comma with the closing text.
+static size_t close(char* buf, size_t size, size_t pos, const char* closing) {
+    pos--;
+    if (!append(buf, size, pos, "%s", closing)) {
+        return 0;
+    }
+    return pos;
+}
+
+size_t formatMeasurement(char* buf, size_t size, const SensirionMeasurement& data, int32_t age) {
+    size_t pos = 0;
+
+    if (!append(buf, size, pos, "%s", "{")) {
+        return 0;
+    }
+    for (const SensorDescriptor& descriptor : SENSOR_DESCRIPTORS) {
+        if (!append(buf, size, pos, "\"%s\":", descriptor.key) ||
+            !appendValue(buf, size, pos, data, descriptor.field)) {
+            return 0;
+        }
+    }
+    if (age >= 0 && !append(buf, size, pos, "%s\"age\":%ld,", "", age)) {
+        return 0;
+    }
+    return close(buf, size, pos, "}");
+}
+
+size_t formatValue(char* buf, size_t size, const SensirionMeasurement& data, SensorField field) {
+    size_t pos = 0;
+
+    if (!appendValue(buf, size, pos, data, field)) {
+        return 0;
+    }
+    // Without the separator.
+    buf[--pos] = '\0';
+    return pos;
+}
+
+size_t formatWindow(char* buf, size_t size, const MeasurementAggregator& window) {
+    size_t pos = formatMeasurement(buf, size, window.mean());
+
+    if (pos == 0) {
+        return 0;
+    }
+    // Reopen the document to add the statistics.
+    pos--;
+    if (!append(buf, size, pos, "%s,\"stats\":{\"n\":%ld,", "", window.count())) {
+        return 0;
+    }
+    for (const SensorDescriptor& descriptor : SENSOR_DESCRIPTORS) {
+        const RunningStats& stats = window.stats(descriptor.field);
+        if (!append(buf, size, pos, "\"%s\":[", descriptor.key) ||
+            !appendValue(buf, size, pos, stats.min(), descriptor.field) ||
+            !appendValue(buf, size, pos, stats.max(), descriptor.field) ||
+            !appendValue(buf, size, pos, stats.stddev(), descriptor.field)) {
+            return 0;
+        }
+        pos = close(buf, size, pos, "],");
+        if (pos == 0) {
+            return 0;
+        }
+    }
+    return close(buf, size, pos, "}}");
+}
@@ -0,0 +1,27 @@
+#ifndef STATE_PAYLOAD_H
+#define STATE_PAYLOAD_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "measurement.h"
+#include "measurement_aggregator.h"
+
+// Size of the preallocated state payload buffers, a window with statistics
+// is up to ~450 bytes.
+#define STATE_PAYLOAD_SIZE 512
+
+// Formats the measurement as the json state document straight from the raw
+// words, without floats or heap allocations. When age is not negative an
+// "age" field is added. Returns the length written, 0 if buf is too small.
+size_t formatMeasurement(char* buf, size_t size, const SensirionMeasurement& data, int32_t age = -1);
+
+// The value of field in the sensor's resolution, null when it is unknown.
+// Returns the length written, 0 if buf is too small.
+size_t formatValue(char* buf, size_t size, const SensirionMeasurement& data, SensorField field);
+
+// The state document of a publish window: the window means under the usual
+// keys, plus "stats" with the sample count "n" and [min, max, stddev] for
+// every field.
+size_t formatWindow(char* buf, size_t size, const MeasurementAggregator& window);
+
+#endif
@@ -0,0 +1,155 @@
+// Host tests of the SEN5x fixed point conversions: pio test -e native
+#include <unity.h>
+
+#include "measurement.h"
+
+static const SensorField PM_FIELDS[] = {SensorField::Pm1p0, SensorField::Pm2p5, SensorField::Pm4p0,
+                                        SensorField::Pm10p0};
+static const SensorField SIGNED_FIELDS[] = {SensorField::Humidity, SensorField::Temperature,
+                                            SensorField::VocIndex, SensorField::NoxIndex};
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Raw values as in the datasheet example of Read Measured Values.
+void test_datasheet_scaling(void) {
+    SensirionMeasurement data;
+
+    data.rawPm2p5 = 255;
+    data.rawHumidity = 4567;
+    data.rawTemperature = 4567;
+    data.rawVocIndex = 1000;
+    data.rawNoxIndex = 10;
+    TEST_ASSERT_EQUAL_FLOAT(25.5f, data.massConcentrationPm2p5());
+    TEST_ASSERT_EQUAL_FLOAT(45.67f, data.ambientHumidity());
+    TEST_ASSERT_EQUAL_FLOAT(22.835f, data.ambientTemperature());
+    TEST_ASSERT_EQUAL_FLOAT(100.0f, data.vocIndex());
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, data.noxIndex());
+
+    data.rawTemperature = -1;
+    TEST_ASSERT_EQUAL_FLOAT(-0.005f, data.ambientTemperature());
+}
+
+void test_scale_per_field(void) {
+    TEST_ASSERT_EQUAL(10, SensirionMeasurement::scale(SensorField::Pm2p5));
+    TEST_ASSERT_EQUAL(100, SensirionMeasurement::scale(SensorField::Humidity));
+    TEST_ASSERT_EQUAL(200, SensirionMeasurement::scale(SensorField::Temperature));
+    TEST_ASSERT_EQUAL(10, SensirionMeasurement::scale(SensorField::VocIndex));
+    TEST_ASSERT_EQUAL(10, SensirionMeasurement::scale(SensorField::NoxIndex));
+}
+
+// Every raw value survives the conversion to float and back.
+void test_round_trip_every_raw_value(void) {
+    for (SensorField field : PM_FIELDS) {
+        for (uint32_t raw = 0; raw < SensirionMeasurement::UNKNOWN_UNSIGNED; raw++) {
+            SensirionMeasurement data;
+            float value = SensirionMeasurement::toFloat((uint16_t) raw, SensirionMeasurement::scale(field));
+            data.setValue(field, value);
+            TEST_ASSERT_EQUAL_UINT32(raw, data.raw(field));
+        }
+    }
+    for (SensorField field : SIGNED_FIELDS) {
+        for (int32_t raw = -32768; raw < SensirionMeasurement::UNKNOWN_SIGNED; raw++) {
+            SensirionMeasurement data;
+            float value = SensirionMeasurement::toFloat((int16_t) raw, SensirionMeasurement::scale(field));
+            data.setValue(field, value);
+            TEST_ASSERT_EQUAL(raw, data.raw(field));
+        }
+    }
+}
+
+// Values are rounded to the nearest step, halves away from zero. The values
+// are exact in binary so the half step is not lost to float rounding.
+void test_rounding_at_half_steps(void) {
+    TEST_ASSERT_EQUAL_UINT16(13, SensirionMeasurement::toUnsigned(1.25f, 10));
+    TEST_ASSERT_EQUAL_UINT16(12, SensirionMeasurement::toUnsigned(1.2499f, 10));
+    TEST_ASSERT_EQUAL_UINT16(1, SensirionMeasurement::toUnsigned(0.05f, 10));
+    TEST_ASSERT_EQUAL_INT16(13, SensirionMeasurement::toSigned(0.125f, 100));
+    TEST_ASSERT_EQUAL_INT16(-13, SensirionMeasurement::toSigned(-0.125f, 100));
+    TEST_ASSERT_EQUAL_INT16(13, SensirionMeasurement::toSigned(0.0625f, 200));
+    TEST_ASSERT_EQUAL_INT16(-13, SensirionMeasurement::toSigned(-0.0625f, 200));
+    TEST_ASSERT_EQUAL_INT16(12, SensirionMeasurement::toSigned(0.0624f, 200));
+    TEST_ASSERT_EQUAL_INT16(13, SensirionMeasurement::toSigned(1.25f, 10));
+    TEST_ASSERT_EQUAL_INT16(-13, SensirionMeasurement::toSigned(-1.25f, 10));
+}
+
+// Out of range values saturate, never onto the unknown marker.
+void test_saturation(void) {
+    TEST_ASSERT_EQUAL_UINT16(0, SensirionMeasurement::toUnsigned(-0.04f, 10));
+    TEST_ASSERT_EQUAL_UINT16(0, SensirionMeasurement::toUnsigned(-1000.0f, 10));
+    TEST_ASSERT_EQUAL_UINT16(0xFFFE, SensirionMeasurement::toUnsigned(6553.4f, 10));
+    TEST_ASSERT_EQUAL_UINT16(0xFFFE, SensirionMeasurement::toUnsigned(6553.5f, 10));
+    TEST_ASSERT_EQUAL_UINT16(0xFFFE, SensirionMeasurement::toUnsigned(1e9f, 10));
+    TEST_ASSERT_EQUAL_UINT16(0xFFFE, SensirionMeasurement::toUnsigned(INFINITY, 10));
+    TEST_ASSERT_EQUAL_UINT16(0, SensirionMeasurement::toUnsigned(-INFINITY, 10));
+
+    TEST_ASSERT_EQUAL_INT16(-32768, SensirionMeasurement::toSigned(-163.84f, 200));
+    TEST_ASSERT_EQUAL_INT16(-32768, SensirionMeasurement::toSigned(-1e9f, 200));
+    TEST_ASSERT_EQUAL_INT16(-32768, SensirionMeasurement::toSigned(-INFINITY, 100));
+    TEST_ASSERT_EQUAL_INT16(0x7FFE, SensirionMeasurement::toSigned(163.83f, 200));
+    TEST_ASSERT_EQUAL_INT16(0x7FFE, SensirionMeasurement::toSigned(1e9f, 200));
+    TEST_ASSERT_EQUAL_INT16(0x7FFE, SensirionMeasurement::toSigned(INFINITY, 10));
+}
+
+void test_unknown_markers(void) {
+    SensirionMeasurement data;
+
+    // A new measurement is unknown in every field.
+    TEST_ASSERT_FLOAT_IS_NAN(data.massConcentrationPm1p0());
+    TEST_ASSERT_FLOAT_IS_NAN(data.massConcentrationPm2p5());
+    TEST_ASSERT_FLOAT_IS_NAN(data.massConcentrationPm4p0());
+    TEST_ASSERT_FLOAT_IS_NAN(data.massConcentrationPm10p0());
+    TEST_ASSERT_FLOAT_IS_NAN(data.ambientHumidity());
+    TEST_ASSERT_FLOAT_IS_NAN(data.ambientTemperature());
+    TEST_ASSERT_FLOAT_IS_NAN(data.vocIndex());
+    TEST_ASSERT_FLOAT_IS_NAN(data.noxIndex());
+    for (size_t i = 0; i < SENSOR_FIELD_COUNT; i++) {
+        TEST_ASSERT_FALSE(data.known((SensorField) i));
+        TEST_ASSERT_FLOAT_IS_NAN(data.value((SensorField) i));
+    }
+
+    TEST_ASSERT_FLOAT_IS_NAN(SensirionMeasurement::toFloat((uint16_t) 0xFFFF, 10));
+    TEST_ASSERT_FLOAT_IS_NAN(SensirionMeasurement::toFloat((int16_t) 0x7FFF, 200));
+
+    // NAN goes back to the markers.
+    TEST_ASSERT_EQUAL_UINT16(0xFFFF, SensirionMeasurement::toUnsigned(NAN, 10));
+    TEST_ASSERT_EQUAL_INT16(0x7FFF, SensirionMeasurement::toSigned(NAN, 100));
+    data.setAmbientTemperature(21.5f);
+    TEST_ASSERT_TRUE(data.known(SensorField::Temperature));
+    data.setValue(SensorField::Temperature, NAN);
+    TEST_ASSERT_EQUAL_INT16(0x7FFF, data.rawTemperature);
+    TEST_ASSERT_FALSE(data.known(SensorField::Temperature));
+}
+
+// The setters and raw() address the same field.
+void test_field_access(void) {
+    SensirionMeasurement data;
+
+    data.setMassConcentrationPm1p0(1.0f);
+    data.setMassConcentrationPm2p5(2.0f);
+    data.setMassConcentrationPm4p0(4.0f);
+    data.setMassConcentrationPm10p0(10.0f);
+    data.setAmbientHumidity(50.0f);
+    data.setAmbientTemperature(-20.0f);
+    data.setVocIndex(100.0f);
+    data.setNoxIndex(1.0f);
+    const int32_t expected[SENSOR_FIELD_COUNT] = {10, 20, 40, 100, 5000, -4000, 1000, 10};
+    for (size_t i = 0; i < SENSOR_FIELD_COUNT; i++) {
+        TEST_ASSERT_EQUAL(expected[i], data.raw((SensorField) i));
+        TEST_ASSERT_TRUE(data.known((SensorField) i));
+    }
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_datasheet_scaling);
+    RUN_TEST(test_scale_per_field);
+    RUN_TEST(test_round_trip_every_raw_value);
+    RUN_TEST(test_rounding_at_half_steps);
+    RUN_TEST(test_saturation);
+    RUN_TEST(test_unknown_markers);
+    RUN_TEST(test_field_access);
+    return UNITY_END();
+}
@@ -0,0 +1,101 @@
+// Host tests of the chunked template rendering: pio test -e native
+#include <string.h>
+#include <unity.h>
+
+#include "page_template.h"
+
+static const char PAGE[] PROGMEM = "<p>%NAME%</p>%% <ul>%ITEMS%</ul>%EMPTY%end";
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// NAME is the text in context, ITEMS a list longer than the small chunks.
+static void expand(void* context, const char* name, size_t length, ChunkWriter& out) {
+    if (length == 4 && strncmp(name, "NAME", length) == 0) {
+        out.printEscaped((const char*) context);
+    } else if (length == 5 && strncmp(name, "ITEMS", length) == 0) {
+        for (int i = 0; i < 5; i++) {
+            out.printf("<li>%d</li>", i);
+        }
+    }
+}
+
+// Renders page in chunks of chunkSize into out, returns the length.
+static size_t render(const char* page, const char* context, size_t chunkSize, char* out, size_t size) {
+    TemplateCursor cursor;
+    uint8_t chunk[64];
+    size_t length = 0;
+
+    for (;;) {
+        ChunkWriter writer(chunk, chunkSize);
+        renderTemplate(page, cursor, writer, expand, (void*) context);
+        TEST_ASSERT_TRUE(length + writer.length() < size);
+        memcpy(out + length, chunk, writer.length());
+        length += writer.length();
+        if (writer.length() < chunkSize) {
+            break;
+        }
+    }
+    out[length] = 0;
+    return length;
+}
+
+void test_whole_page(void) {
+    char page[256];
+
+    render(PAGE, "a&b", 64, page, sizeof(page));
+    TEST_ASSERT_EQUAL_STRING("<p>a&amp;b</p>% <ul><li>0</li><li>1</li><li>2</li><li>3</li><li>4</li></ul>end",
+                             page);
+}
+
+// Every chunk size gives the same page, whether a chunk ends in the text, in
+// a placeholder or in the middle of an expansion.
+void test_chunk_sizes(void) {
+    char expected[256];
+    char page[256];
+
+    size_t length = render(PAGE, "a&b", 64, expected, sizeof(expected));
+    for (size_t chunkSize = 1; chunkSize < 64; chunkSize++) {
+        TEST_ASSERT_EQUAL(length, render(PAGE, "a&b", chunkSize, page, sizeof(page)));
+        TEST_ASSERT_EQUAL_STRING(expected, page);
+    }
+}
+
+// A chunk picks up after the last, rendering stops once the page is done.
+void test_resumes_after_previous_chunk(void) {
+    TemplateCursor cursor;
+    uint8_t chunk[8];
+
+    ChunkWriter first(chunk, 6);
+    renderTemplate(PAGE, cursor, first, expand, (void*) "name");
+    TEST_ASSERT_EQUAL(6, first.length());
+    TEST_ASSERT_EQUAL_MEMORY("<p>nam", chunk, 6);
+
+    ChunkWriter second(chunk, 6);
+    renderTemplate(PAGE, cursor, second, expand, (void*) "name");
+    TEST_ASSERT_EQUAL(6, second.length());
+    TEST_ASSERT_EQUAL_MEMORY("e</p>%", chunk, 6);
+
+    char rest[128];
+    render(PAGE + cursor.offset, "name", 8, rest, sizeof(rest));
+    TEST_ASSERT_EQUAL_STRING(" <ul><li>0</li><li>1</li><li>2</li><li>3</li><li>4</li></ul>end", rest);
+}
+
+void test_unterminated_placeholder(void) {
+    static const char page[] PROGMEM = "text %NAME";
+    char out[32];
+
+    render(page, "x", 16, out, sizeof(out));
+    TEST_ASSERT_EQUAL_STRING("text ", out);
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_whole_page);
+    RUN_TEST(test_chunk_sizes);
+    RUN_TEST(test_resumes_after_previous_chunk);
+    RUN_TEST(test_unterminated_placeholder);
+    return UNITY_END();
+}
@@ -0,0 +1,80 @@
+// Host tests of the MQTT reconnect backoff: pio test -e native
+#include <unity.h>
+
+#include "reconnect_backoff.h"
+
+// Full delays of consecutive failures, doubling from 1 s to the 60 s cap.
+static const unsigned long DELAYS[] = {1000, 2000, 4000, 8000, 16000, 32000, 60000, 60000, 60000};
+static const size_t DELAY_COUNT = sizeof(DELAYS) / sizeof(DELAYS[0]);
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// A jitter of half the delay gives the delay itself.
+void test_delay_doubles_up_to_cap(void) {
+    ReconnectBackoff backoff(1000, 60000);
+
+    for (size_t i = 0; i < DELAY_COUNT; i++) {
+        TEST_ASSERT_EQUAL_UINT32(DELAYS[i], backoff.nextDelay(DELAYS[i] / 2));
+    }
+}
+
+void test_no_jitter_gives_half_delay(void) {
+    ReconnectBackoff backoff(1000, 60000);
+
+    for (size_t i = 0; i < DELAY_COUNT; i++) {
+        TEST_ASSERT_EQUAL_UINT32(DELAYS[i] / 2, backoff.nextDelay(0));
+    }
+}
+
+// Any jitter keeps the delay in [delay/2, delay].
+void test_jitter_stays_within_bounds(void) {
+    uint32_t random = 12345;
+
+    for (int run = 0; run < 200; run++) {
+        ReconnectBackoff backoff(1000, 60000);
+        for (size_t i = 0; i < DELAY_COUNT; i++) {
+            random = random * 1103515245UL + 12345;
+            unsigned long delay = backoff.nextDelay(random);
+            TEST_ASSERT_GREATER_OR_EQUAL_UINT32(DELAYS[i] / 2, delay);
+            TEST_ASSERT_LESS_OR_EQUAL_UINT32(DELAYS[i], delay);
+        }
+    }
+    ReconnectBackoff backoff(1000, 60000);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(1000, backoff.nextDelay(0xFFFFFFFFUL));
+}
+
+// MqttConnection resets the backoff on a successful connect, the next
+// outage starts from the minimum delay again.
+void test_reset_after_connect(void) {
+    ReconnectBackoff backoff(1000, 60000);
+
+    for (size_t i = 0; i < DELAY_COUNT; i++) {
+        backoff.nextDelay(0);
+    }
+    backoff.reset();
+    TEST_ASSERT_EQUAL_UINT32(1000, backoff.nextDelay(500));
+    TEST_ASSERT_EQUAL_UINT32(2000, backoff.nextDelay(1000));
+}
+
+// A maximum that is not a power of two times the minimum is still reached.
+void test_cap_not_a_power_of_two(void) {
+    ReconnectBackoff backoff(1000, 5000);
+    const unsigned long delays[] = {1000, 2000, 4000, 5000, 5000};
+
+    for (unsigned long delay : delays) {
+        TEST_ASSERT_EQUAL_UINT32(delay, backoff.nextDelay(delay / 2));
+    }
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_delay_doubles_up_to_cap);
+    RUN_TEST(test_no_jitter_gives_half_delay);
+    RUN_TEST(test_jitter_stays_within_bounds);
+    RUN_TEST(test_reset_after_connect);
+    RUN_TEST(test_cap_not_a_power_of_two);
+    return UNITY_END();
+}
@@ -0,0 +1,161 @@
+// Host tests of the store and forward buffer: pio test -e native
+#include <unity.h>
+
+#include "ring_buffer.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Pops everything and checks it against expected, oldest first.
+template <size_t Capacity>
+static void assertContents(RingBuffer<int, Capacity>& buffer, const int* expected, size_t count) {
+    int item;
+
+    TEST_ASSERT_EQUAL(count, buffer.size());
+    for (size_t i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(expected[i], buffer.peek(i));
+    }
+    for (size_t i = 0; i < count; i++) {
+        TEST_ASSERT_TRUE(buffer.pop(&item));
+        TEST_ASSERT_EQUAL(expected[i], item);
+    }
+    TEST_ASSERT_TRUE(buffer.empty());
+    TEST_ASSERT_FALSE(buffer.pop(&item));
+}
+
+void test_fifo_order(void) {
+    RingBuffer<int, 8> buffer;
+    const int expected[] = {0, 1, 2, 3, 4};
+
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_FALSE(buffer.push(i));
+    }
+    TEST_ASSERT_FALSE(buffer.full());
+    assertContents(buffer, expected, 5);
+    TEST_ASSERT_EQUAL_UINT32(0, buffer.dropped());
+}
+
+// Pushes and pops interleaved so head and tail wrap around the storage.
+void test_wraparound(void) {
+    RingBuffer<int, 4> buffer;
+    int next = 0, expected = 0, item;
+
+    for (int round = 0; round < 10; round++) {
+        while (!buffer.full()) {
+            buffer.push(next++);
+        }
+        for (int i = 0; i < 3; i++) {
+            TEST_ASSERT_TRUE(buffer.pop(&item));
+            TEST_ASSERT_EQUAL(expected++, item);
+        }
+    }
+    TEST_ASSERT_EQUAL(1, buffer.size());
+    TEST_ASSERT_EQUAL(expected, buffer.peek());
+    TEST_ASSERT_EQUAL_UINT32(0, buffer.dropped());
+}
+
+void test_drop_oldest_evicts_in_order(void) {
+    RingBuffer<int, 4> buffer(DropPolicy::DropOldest);
+    int evicted = -1;
+
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_FALSE(buffer.push(i, &evicted));
+    }
+    TEST_ASSERT_TRUE(buffer.full());
+    for (int i = 4; i < 10; i++) {
+        TEST_ASSERT_TRUE(buffer.push(i, &evicted));
+        TEST_ASSERT_EQUAL(i - 4, evicted);
+        TEST_ASSERT_EQUAL_UINT32(i - 3, buffer.dropped());
+    }
+    const int expected[] = {6, 7, 8, 9};
+    assertContents(buffer, expected, 4);
+    TEST_ASSERT_EQUAL_UINT32(6, buffer.dropped());
+}
+
+// Every time the buffer fills up every other entry is thrown away and the
+// stride doubles, later entries are taken at the new stride.
+void test_decimate_stride_and_skip(void) {
+    RingBuffer<int, 4> buffer(DropPolicy::Decimate);
+    int evicted = -1;
+
+    for (int i = 0; i < 4; i++) {
+        buffer.push(i);
+    }
+    // Full, 1 and 3 go, 4 is taken at stride 2.
+    TEST_ASSERT_FALSE(buffer.push(4, &evicted));
+    TEST_ASSERT_EQUAL(-1, evicted);
+    TEST_ASSERT_EQUAL(3, buffer.size());
+    TEST_ASSERT_EQUAL_UINT32(2, buffer.dropped());
+    // 5 is skipped, 6 taken.
+    buffer.push(5);
+    buffer.push(6);
+    TEST_ASSERT_EQUAL_UINT32(3, buffer.dropped());
+    TEST_ASSERT_TRUE(buffer.full());
+    // 7 skipped, full at 8: 2 and 6 go, stride 4.
+    buffer.push(7);
+    buffer.push(8);
+    TEST_ASSERT_EQUAL_UINT32(6, buffer.dropped());
+    for (int i = 9; i <= 12; i++) {
+        buffer.push(i);
+    }
+    TEST_ASSERT_EQUAL_UINT32(9, buffer.dropped());
+
+    const int expected[] = {0, 4, 8, 12};
+    assertContents(buffer, expected, 4);
+}
+
+// Entries pushed and dropped add up, and an emptied buffer takes every
+// entry again.
+void test_decimate_counts_and_reset(void) {
+    RingBuffer<int, 8> buffer(DropPolicy::Decimate);
+    const int pushed = 1000;
+
+    for (int i = 0; i < pushed; i++) {
+        buffer.push(i);
+    }
+    TEST_ASSERT_EQUAL_UINT32(pushed, buffer.size() + buffer.dropped());
+    // The whole range is still covered, oldest first and evenly spaced.
+    int stride = buffer.peek(1) - buffer.peek(0);
+    TEST_ASSERT_EQUAL(0, buffer.peek(0));
+    for (size_t i = 1; i < buffer.size(); i++) {
+        TEST_ASSERT_EQUAL(stride, buffer.peek(i) - buffer.peek(i - 1));
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL(pushed - stride, buffer.peek(buffer.size() - 1));
+
+    uint32_t dropped = buffer.dropped();
+    while (buffer.pop()) {
+    }
+    const int expected[] = {1, 2, 3};
+    for (int i = 1; i <= 3; i++) {
+        buffer.push(i);
+    }
+    TEST_ASSERT_EQUAL_UINT32(dropped, buffer.dropped());
+    assertContents(buffer, expected, 3);
+}
+
+void test_clear(void) {
+    RingBuffer<int, 4> buffer(DropPolicy::Decimate);
+
+    for (int i = 0; i < 6; i++) {
+        buffer.push(i);
+    }
+    buffer.clear();
+    TEST_ASSERT_TRUE(buffer.empty());
+    buffer.push(10);
+    buffer.push(11);
+    const int expected[] = {10, 11};
+    assertContents(buffer, expected, 2);
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_fifo_order);
+    RUN_TEST(test_wraparound);
+    RUN_TEST(test_drop_oldest_evicts_in_order);
+    RUN_TEST(test_decimate_stride_and_skip);
+    RUN_TEST(test_decimate_counts_and_reset);
+    RUN_TEST(test_clear);
+    return UNITY_END();
+}
@@ -0,0 +1,179 @@
+// Host tests of the publish window statistics: pio test -e native
+#include <math.h>
+#include <unity.h>
+
+#include "measurement_aggregator.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Two pass reference in double: the mean first, then the squared
+// deviations from it.
+static void reference(const float* values, size_t count, double& mean, double& stddev) {
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    mean = sum / count;
+    double squares = 0;
+    for (size_t i = 0; i < count; i++) {
+        squares += (values[i] - mean) * (values[i] - mean);
+    }
+    stddev = count > 1 ? sqrt(squares / (count - 1)) : 0.0;
+}
+
+// xorshift32, deterministic noise in [-1, 1].
+static float noise(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (float) ((double) state / 4294967295.0 * 2.0 - 1.0);
+}
+
+static void assertMatchesReference(const float* values, size_t count, float meanTolerance, float stddevTolerance) {
+    RunningStats stats;
+    double mean, stddev;
+
+    for (size_t i = 0; i < count; i++) {
+        stats.add(values[i]);
+    }
+    reference(values, count, mean, stddev);
+    TEST_ASSERT_EQUAL_UINT32(count, stats.count());
+    TEST_ASSERT_FLOAT_WITHIN(meanTolerance, mean, stats.mean());
+    TEST_ASSERT_FLOAT_WITHIN(stddevTolerance, stddev, stats.stddev());
+}
+
+void test_empty_window(void) {
+    RunningStats stats;
+
+    TEST_ASSERT_EQUAL_UINT32(0, stats.count());
+    TEST_ASSERT_FLOAT_IS_NAN(stats.mean());
+    TEST_ASSERT_FLOAT_IS_NAN(stats.min());
+    TEST_ASSERT_FLOAT_IS_NAN(stats.max());
+    TEST_ASSERT_FLOAT_IS_NAN(stats.stddev());
+
+    // Unknown values are not counted.
+    stats.add(NAN);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.count());
+    TEST_ASSERT_FLOAT_IS_NAN(stats.mean());
+}
+
+void test_single_sample(void) {
+    RunningStats stats;
+
+    stats.add(-12.5f);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.count());
+    TEST_ASSERT_EQUAL_FLOAT(-12.5f, stats.mean());
+    TEST_ASSERT_EQUAL_FLOAT(-12.5f, stats.min());
+    TEST_ASSERT_EQUAL_FLOAT(-12.5f, stats.max());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, stats.stddev());
+}
+
+void test_min_max(void) {
+    RunningStats stats;
+    const float values[] = {3.0f, -1.5f, 7.25f, 7.0f, NAN, -1.0f, 0.0f};
+
+    for (float value : values) {
+        stats.add(value);
+    }
+    TEST_ASSERT_EQUAL_UINT32(6, stats.count());
+    TEST_ASSERT_EQUAL_FLOAT(-1.5f, stats.min());
+    TEST_ASSERT_EQUAL_FLOAT(7.25f, stats.max());
+
+    stats.reset();
+    TEST_ASSERT_EQUAL_UINT32(0, stats.count());
+    TEST_ASSERT_FLOAT_IS_NAN(stats.min());
+    stats.add(4.0f);
+    TEST_ASSERT_EQUAL_FLOAT(4.0f, stats.min());
+    TEST_ASSERT_EQUAL_FLOAT(4.0f, stats.max());
+}
+
+void test_known_values(void) {
+    RunningStats stats;
+    const float values[] = {2, 4, 4, 4, 5, 5, 7, 9};
+
+    for (float value : values) {
+        stats.add(value);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, stats.mean());
+    // Sample standard deviation, sqrt(32 / 7).
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, 2.13808994f, stats.stddev());
+}
+
+// A day of 1 Hz samples of a typical signal.
+void test_matches_two_pass_reference(void) {
+    static float values[86400];
+    uint32_t state = 42;
+
+    for (size_t i = 0; i < 86400; i++) {
+        values[i] = 20.0f + 5.0f * sinf(i / 13750.0f) + noise(state);
+    }
+    assertMatchesReference(values, 86400, 1e-5f, 1e-5f);
+}
+
+// A large offset with a small variance, where the textbook sum of squares
+// formula cancels catastrophically. Welford keeps the stddev exact to the
+// precision of the float result.
+void test_large_offset_low_variance(void) {
+    static float values[10000];
+    uint32_t state = 7;
+
+    for (size_t i = 0; i < 10000; i++) {
+        // Steps of 1/16, exactly representable next to 1e6.
+        values[i] = 1000000.0f + roundf(noise(state) * 8.0f) / 16.0f;
+    }
+    assertMatchesReference(values, 10000, 0.0625f, 1e-6f);
+
+    // The same offset in the temperature range of the sensor.
+    for (size_t i = 0; i < 10000; i++) {
+        values[i] = 4000.0f + noise(state) * 0.01f;
+    }
+    assertMatchesReference(values, 10000, 1e-3f, 1e-7f);
+}
+
+// Identical values have no spread, not a small negative or NAN one.
+void test_constant_series(void) {
+    RunningStats stats;
+
+    for (int i = 0; i < 100000; i++) {
+        stats.add(163.83f);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(163.83f, stats.mean());
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, stats.stddev());
+}
+
+// The aggregator leaves unknown fields out and rounds the means to the
+// sensor's resolution.
+void test_aggregator_means(void) {
+    MeasurementAggregator aggregator;
+    SensirionMeasurement data;
+
+    data.rawPm2p5 = 10;
+    data.rawTemperature = 4001;
+    aggregator.add(data);
+    data.rawPm2p5 = 12;
+    data.rawTemperature = SensirionMeasurement::UNKNOWN_SIGNED;
+    aggregator.add(data);
+
+    SensirionMeasurement mean = aggregator.mean();
+    TEST_ASSERT_EQUAL_UINT32(2, aggregator.count());
+    TEST_ASSERT_EQUAL_UINT16(11, mean.rawPm2p5);
+    TEST_ASSERT_EQUAL_INT16(4001, mean.rawTemperature);
+    TEST_ASSERT_EQUAL_UINT32(1, aggregator.stats(SensorField::Temperature).count());
+    TEST_ASSERT_FALSE(mean.known(SensorField::Humidity));
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_window);
+    RUN_TEST(test_single_sample);
+    RUN_TEST(test_min_max);
+    RUN_TEST(test_known_values);
+    RUN_TEST(test_matches_two_pass_reference);
+    RUN_TEST(test_large_offset_low_variance);
+    RUN_TEST(test_constant_series);
+    RUN_TEST(test_aggregator_means);
+    return UNITY_END();
+}
@@ -0,0 +1,166 @@
+// Host tests of the sample history: pio test -e native
+#include <string.h>
+#include <string>
+#include <unity.h>
+
+#include "sample_history.h"
+
+static SampleHistory* history;
+
+void setUp(void) {
+    history = new SampleHistory();
+}
+
+void tearDown(void) {
+    delete history;
+}
+
+static SensirionMeasurement sample(uint16_t pm, int16_t temperature) {
+    SensirionMeasurement data;
+    data.rawPm2p5 = pm;
+    data.rawTemperature = temperature;
+    return data;
+}
+
+void test_rollup_mean_rounds_half_away_from_zero(void) {
+    Rollup rollup;
+
+    rollup.reset(7);
+    rollup.add(sample(1, -3));
+    rollup.add(sample(2, -4));
+    SensirionMeasurement mean = rollup.mean();
+    TEST_ASSERT_EQUAL_UINT32(7, rollup.period());
+    TEST_ASSERT_EQUAL_UINT32(2, rollup.count());
+    TEST_ASSERT_EQUAL(2, mean.raw(SensorField::Pm2p5));
+    TEST_ASSERT_EQUAL(-4, mean.raw(SensorField::Temperature));
+    TEST_ASSERT_FALSE(mean.known(SensorField::Humidity));
+
+    // Unknown values are left out of the mean, not counted as zero.
+    rollup.add(SensirionMeasurement());
+    rollup.add(sample(2, -4));
+    mean = rollup.mean();
+    TEST_ASSERT_EQUAL_UINT32(4, rollup.count());
+    TEST_ASSERT_EQUAL(2, mean.raw(SensorField::Pm2p5));
+    TEST_ASSERT_EQUAL(-4, mean.raw(SensorField::Temperature));
+
+    rollup.reset(8);
+    TEST_ASSERT_EQUAL_UINT32(0, rollup.count());
+    TEST_ASSERT_FALSE(rollup.mean().known(SensorField::Pm2p5));
+}
+
+// One sample a second for 31 minutes, every minute mean is the rounded mean
+// of its samples and lies within their min and max.
+void test_minute_and_quarter_means(void) {
+    for (uint32_t time = 0; time < 31 * 60; time++) {
+        history->add(time, sample((uint16_t) (time * 37 % 101), (int16_t) (time % 60) - 30));
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(30, history->end(HistoryResolution::Minute));
+    for (uint32_t minute = 0; minute < 30; minute++) {
+        HistoryEntry entry;
+        int32_t sum = 0, min = 0xFFFF, max = 0;
+        for (uint32_t time = minute * 60; time < minute * 60 + 60; time++) {
+            int32_t pm = time * 37 % 101;
+            sum += pm;
+            min = pm < min ? pm : min;
+            max = pm > max ? pm : max;
+        }
+        TEST_ASSERT_TRUE(history->get(HistoryResolution::Minute, minute, entry));
+        TEST_ASSERT_EQUAL_UINT32(minute * 60, entry.time);
+        TEST_ASSERT_EQUAL((2 * sum + 60) / 120, entry.data.raw(SensorField::Pm2p5));
+        TEST_ASSERT_TRUE(entry.data.raw(SensorField::Pm2p5) >= min && entry.data.raw(SensorField::Pm2p5) <= max);
+        // -30 to 29, the mean -0.5 rounds away from zero.
+        TEST_ASSERT_EQUAL(-1, entry.data.raw(SensorField::Temperature));
+    }
+
+    HistoryEntry entry;
+    TEST_ASSERT_EQUAL_UINT32(2, history->end(HistoryResolution::QuarterHour));
+    TEST_ASSERT_TRUE(history->get(HistoryResolution::QuarterHour, 1, entry));
+    TEST_ASSERT_EQUAL_UINT32(900, entry.time);
+    TEST_ASSERT_EQUAL(-1, entry.data.raw(SensorField::Temperature));
+}
+
+// The tier keeps capacity - 1 readable entries, spacing seconds apart.
+static void assertWrapped(HistoryResolution resolution, size_t capacity, uint32_t end, uint32_t spacing) {
+    HistoryEntry entry;
+    uint32_t begin = end - (capacity - 1);
+
+    TEST_ASSERT_EQUAL_UINT32(end, history->end(resolution));
+    TEST_ASSERT_EQUAL_UINT32(begin, history->begin(resolution));
+    TEST_ASSERT_FALSE(history->get(resolution, begin - 1, entry));
+    TEST_ASSERT_FALSE(history->get(resolution, end, entry));
+    TEST_ASSERT_TRUE(history->get(resolution, begin, entry));
+    TEST_ASSERT_EQUAL_UINT32(begin * spacing, entry.time);
+    TEST_ASSERT_TRUE(history->get(resolution, end - 1, entry));
+    TEST_ASSERT_EQUAL_UINT32((end - 1) * spacing, entry.time);
+}
+
+// One sample a minute for 100 quarter hours overruns every tier.
+void test_every_tier_wraps(void) {
+    const uint32_t samples = 100 * 15 + 1;
+
+    for (uint32_t i = 0; i < samples; i++) {
+        history->add(i * 60, sample((uint16_t) (i % 1000), 0));
+    }
+    assertWrapped(HistoryResolution::Raw, HISTORY_RAW_CAPACITY, samples, 60);
+    // The last period of the rollups is still open.
+    assertWrapped(HistoryResolution::Minute, HISTORY_MINUTE_CAPACITY, samples - 1, 60);
+    assertWrapped(HistoryResolution::QuarterHour, HISTORY_QUARTER_CAPACITY, 100, 900);
+}
+
+// The whole response, written through pieces of pieceSize. Fails if a piece
+// is empty before the response is complete.
+static std::string render(const char* format, size_t pieceSize) {
+    HistoryQuery query;
+    std::string response;
+    char buf[512];
+    size_t n;
+
+    TEST_ASSERT_TRUE(parseHistoryQuery("pm2p5", "raw", format, 1000, query));
+    while ((n = formatHistory(*history, query, buf, pieceSize)) > 0) {
+        TEST_ASSERT_TRUE(n <= pieceSize);
+        response.append(buf, n);
+    }
+    TEST_ASSERT_EQUAL_size_t(0, formatHistory(*history, query, buf, pieceSize));
+    return response;
+}
+
+void test_empty_history_in_small_pieces(void) {
+    for (size_t size = 1; size < 64; size++) {
+        TEST_ASSERT_EQUAL_STRING("{\"field\":\"pm2p5\",\"res\":\"raw\",\"interval\":1,\"points\":[]}",
+                                 render("json", size).c_str());
+        TEST_ASSERT_EQUAL_STRING("age,pm2p5\n", render("csv", size).c_str());
+    }
+}
+
+// Pieces smaller than the header or one entry give the same response as a
+// single one.
+void test_pieces_match_single_response(void) {
+    history->add(990, sample(15, 0));
+    history->add(991, SensirionMeasurement());
+    history->add(992, sample(1234, 0));
+    history->add(993, sample(7, 0));
+
+    std::string json = render("json", 512);
+    std::string csv = render("csv", 512);
+    TEST_ASSERT_EQUAL_STRING("{\"field\":\"pm2p5\",\"res\":\"raw\",\"interval\":1,\"points\":"
+                             "[[10,1.5],[9,null],[8,123.4],[7,0.7]]}",
+                             json.c_str());
+    TEST_ASSERT_EQUAL_STRING("age,pm2p5\n10,1.5\n9,\n8,123.4\n7,0.7\n", csv.c_str());
+    for (size_t size = 1; size < 64; size++) {
+        TEST_ASSERT_EQUAL_STRING(json.c_str(), render("json", size).c_str());
+        TEST_ASSERT_EQUAL_STRING(csv.c_str(), render("csv", size).c_str());
+    }
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_rollup_mean_rounds_half_away_from_zero);
+    RUN_TEST(test_minute_and_quarter_means);
+    RUN_TEST(test_every_tier_wraps);
+    RUN_TEST(test_empty_history_in_small_pieces);
+    RUN_TEST(test_pieces_match_single_response);
+    return UNITY_END();
+}
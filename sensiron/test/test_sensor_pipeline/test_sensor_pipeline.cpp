@@ -0,0 +1,162 @@
+// Host tests of the store and forward path of the pipeline: pio test -e native
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "sensor_pipeline.h"
+
+// Clock set by the test.
+class TestClock : public Clock {
+public:
+    unsigned long now = 0;
+
+    unsigned long millis() override { return now; }
+    uint32_t micros() override { return (uint32_t) (now * 1000); }
+    long random() override { return 0; }
+};
+
+// Broker connection that accepts failReplayAfter replay messages, the next
+// one fails and drops the connection like a broker going away.
+class TestClient : public MqttClient {
+public:
+    bool up = true;
+    bool isConnected = false;
+    int failReplayAfter = -1;
+    int replayed = 0;
+
+    void setServer(const char*, uint16_t) override {}
+    bool connect(const char*) override { return isConnected = up; }
+    bool connected() override { return isConnected; }
+    bool loop() override { return isConnected; }
+    void disconnect() override { isConnected = false; }
+    bool publish(const char* topic, const uint8_t*, size_t, bool) override {
+        if (!isConnected) {
+            return false;
+        }
+        size_t length = strlen(topic);
+        if (length >= 7 && strcmp(topic + length - 7, "/replay") == 0) {
+            if (replayed == failReplayAfter) {
+                up = false;
+                isConnected = false;
+                return false;
+            }
+            replayed++;
+        }
+        return true;
+    }
+    bool subscribe(const char*) override { return isConnected; }
+    bool unsubscribe(const char*) override { return isConnected; }
+    int state() override { return isConnected ? 0 : -4; }
+};
+
+// Never read, the windows are handed to publishWindow() directly.
+class TestSensor : public Sensor {
+public:
+    bool beginRead(unsigned long) override { return false; }
+    Sen5xReadResult pollRead(unsigned long, SensirionMeasurement&) override { return Sen5xReadResult::Error; }
+    bool reading() const override { return false; }
+    unsigned long readIdleTime(unsigned long) const override { return 1000; }
+    const char* serialNumber() const override { return ""; }
+    const char* hwVersion() const override { return ""; }
+    const char* swVersion() const override { return ""; }
+};
+
+class TestListener : public SampleListener {
+public:
+    void sampleRead(size_t, unsigned long, const SensirionMeasurement&) override {}
+    void windowClosed(size_t, unsigned long, const MeasurementAggregator&) override {}
+};
+
+static TestClock testClock;
+static TestClient client;
+static TestSensor sensor;
+static TestListener listener;
+static SensorChannel channels[1];
+static SensorPipeline* pipeline;
+
+void setUp(void) {
+    Settings settings;
+
+    testClock = TestClock();
+    client = TestClient();
+    channels[0] = SensorChannel();
+    channels[0].sensor = &sensor;
+    pipeline = new SensorPipeline(testClock, client, channels, 1, listener);
+
+    memset(&settings, 0, sizeof(settings));
+    snprintf(settings.stateTopic, sizeof(settings.stateTopic), "test/sensor");
+    snprintf(settings.mqttServer, sizeof(settings.mqttServer), "broker");
+    settings.mqttPort = 1883;
+    settings.mqttEnabled = 1;
+    settings.publishInterval = 10;
+    settings.heartbeat = 10;
+    pipeline->applySettings(settings);
+}
+
+void tearDown(void) {
+    delete pipeline;
+}
+
+// Publishes one window every 10 s while the broker is down, the heartbeat
+// lets every one of them through the report filter into the buffer.
+static void bufferWindows(int count) {
+    MeasurementAggregator window;
+    SensirionMeasurement data;
+
+    client.up = false;
+    for (int i = 0; i < count; i++) {
+        data.setMassConcentrationPm2p5((float) i);
+        window.reset();
+        window.add(data);
+        pipeline->publishWindow(0, window, testClock.now);
+        testClock.now += 10000;
+    }
+}
+
+void test_replay_sends_oldest_first_and_empties_buffer(void) {
+    bufferWindows(6);
+    TEST_ASSERT_EQUAL(6, pipeline->sampleBuffer().size());
+
+    client.up = true;
+    pipeline->loop(testClock.now);
+    TEST_ASSERT_EQUAL(REPLAY_BATCH_SIZE, client.replayed);
+    TEST_ASSERT_EQUAL(6 - REPLAY_BATCH_SIZE, pipeline->sampleBuffer().size());
+    TEST_ASSERT_EQUAL_UINT32(40, pipeline->sampleBuffer().peek().timestamp);
+
+    testClock.now += REPLAY_INTERVAL_MS;
+    pipeline->loop(testClock.now);
+    TEST_ASSERT_EQUAL(6, client.replayed);
+    TEST_ASSERT_TRUE(pipeline->sampleBuffer().empty());
+}
+
+// The broker goes away after two replayed samples, the sample that failed
+// and the ones after it stay buffered and go out after the reconnect.
+void test_failed_replay_keeps_samples(void) {
+    bufferWindows(6);
+
+    client.up = true;
+    client.failReplayAfter = 2;
+    pipeline->loop(testClock.now);
+    TEST_ASSERT_EQUAL(2, client.replayed);
+    TEST_ASSERT_EQUAL(4, pipeline->sampleBuffer().size());
+    for (size_t i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL_UINT32(20 + 10 * i, pipeline->sampleBuffer().peek(i).timestamp);
+    }
+
+    client.up = true;
+    client.failReplayAfter = -1;
+    testClock.now += REPLAY_INTERVAL_MS;
+    pipeline->loop(testClock.now);
+    TEST_ASSERT_TRUE(client.connected());
+    TEST_ASSERT_EQUAL(2 + REPLAY_BATCH_SIZE, client.replayed);
+    TEST_ASSERT_TRUE(pipeline->sampleBuffer().empty());
+}
+
+int main(int argc, char** argv) {
+    (void) argc;
+    (void) argv;
+    UNITY_BEGIN();
+    RUN_TEST(test_replay_sends_oldest_first_and_empties_buffer);
+    RUN_TEST(test_failed_replay_keeps_samples);
+    return UNITY_END();
+}
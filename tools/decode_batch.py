@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+"""Decodes and validates batch payloads published to <state topic>/batch.
+
+The payload is read from a file or stdin, as raw bytes or with --hex as a hex
+string. The encoding is detected from the first bytes. Samples are printed as
+CSV with the age of every sample in seconds at publish time, or as JSON lines
+with --json. Exits with status 1 if the payload does not match the schema in
+doc/batch_payload.md.
+
+    mosquitto_sub -t environment/sensirion/batch -C 1 | tools/decode_batch.py
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+VERSION = 1
+# Field order and scales of the binary encoding, which does not carry them.
+FIELDS = ["pm1p0", "pm2p5", "pm4p0", "pm10p0", "temperature", "humidity", "vocIndex", "noxIndex"]
+SCALES = [10, 10, 10, 10, 200, 100, 10, 10]
+
+
+class BatchError(Exception):
+    pass
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def byte(self):
+        if self.pos >= len(self.data):
+            raise BatchError("payload truncated at byte %d" % self.pos)
+        value = self.data[self.pos]
+        self.pos += 1
+        return value
+
+    def take(self, count):
+        if self.pos + count > len(self.data):
+            raise BatchError("payload truncated at byte %d" % self.pos)
+        value = self.data[self.pos:self.pos + count]
+        self.pos += count
+        return value
+
+    def varint(self):
+        value = shift = 0
+        while True:
+            b = self.byte()
+            value |= (b & 0x7F) << shift
+            if not b & 0x80:
+                return value
+            shift += 7
+            if shift > 28:
+                raise BatchError("varint too long at byte %d" % self.pos)
+
+    def zigzag(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+
+def unpack(reader):
+    """Minimal MessagePack decoder for the types the firmware emits."""
+    b = reader.byte()
+    if b <= 0x7F:
+        return b
+    if b >= 0xE0:
+        return b - 0x100
+    if 0x80 <= b <= 0x8F:
+        return {unpack(reader): unpack(reader) for _ in range(b & 0x0F)}
+    if 0x90 <= b <= 0x9F:
+        return [unpack(reader) for _ in range(b & 0x0F)]
+    if 0xA0 <= b <= 0xBF:
+        return reader.take(b & 0x1F).decode("utf-8")
+    formats = {0xCC: ">B", 0xCD: ">H", 0xCE: ">I", 0xD0: ">b", 0xD1: ">h", 0xD2: ">i"}
+    if b in formats:
+        fmt = formats[b]
+        return struct.unpack(fmt, reader.take(struct.calcsize(fmt)))[0]
+    if b == 0xC0:
+        return None
+    if b == 0xDC:
+        return [unpack(reader) for _ in range(struct.unpack(">H", reader.take(2))[0])]
+    raise BatchError("unsupported MessagePack type 0x%02x" % b)
+
+
+def from_document(doc):
+    """Validates the json/MessagePack document, returns (age, fields, scales, dt, rows)."""
+    if not isinstance(doc, dict):
+        raise BatchError("document is not a map")
+    missing = {"v", "age", "fields", "scale", "dt", "d"} - set(doc)
+    if missing:
+        raise BatchError("missing keys: %s" % ", ".join(sorted(missing)))
+    if doc["v"] != VERSION:
+        raise BatchError("unsupported version %r" % doc["v"])
+    fields, scales, dt, rows = doc["fields"], doc["scale"], doc["dt"], doc["d"]
+    if len(fields) != len(scales):
+        raise BatchError("%d fields but %d scales" % (len(fields), len(scales)))
+    if len(dt) != len(rows):
+        raise BatchError("%d time deltas but %d samples" % (len(dt), len(rows)))
+    for row in rows:
+        if len(row) != len(fields):
+            raise BatchError("sample with %d values, expected %d" % (len(row), len(fields)))
+    return doc["age"], fields, scales, dt, rows
+
+
+def from_binary(data):
+    reader = Reader(data)
+    if reader.take(2) != b"SB":
+        raise BatchError("bad magic")
+    version = reader.byte()
+    if version != VERSION:
+        raise BatchError("unsupported version %d" % version)
+    field_count = reader.byte()
+    if field_count != len(FIELDS):
+        raise BatchError("%d fields, this decoder knows %d" % (field_count, len(FIELDS)))
+    count = reader.byte()
+    age = reader.varint()
+    previous = [0] * field_count
+    dt, rows = [], []
+    for _ in range(count):
+        dt.append(reader.varint())
+        mask = reader.byte()
+        row = []
+        for j in range(field_count):
+            if mask & (1 << j):
+                previous[j] += reader.zigzag()
+                row.append(previous[j])
+            else:
+                row.append(None)
+        rows.append(row)
+    if reader.pos != len(data):
+        raise BatchError("%d trailing bytes" % (len(data) - reader.pos))
+    return age, FIELDS, SCALES, dt, rows
+
+
+def decode(data):
+    if data[:1] == b"{":
+        try:
+            return "json", from_document(json.loads(data.decode("utf-8")))
+        except ValueError as error:
+            raise BatchError("invalid json: %s" % error)
+    if data[:2] == b"SB":
+        return "binary", from_binary(data)
+    if data[:1] and 0x80 <= data[0] <= 0x8F:
+        reader = Reader(data)
+        doc = unpack(reader)
+        if reader.pos != len(data):
+            raise BatchError("%d trailing bytes" % (len(data) - reader.pos))
+        return "msgpack", from_document(doc)
+    raise BatchError("unknown encoding")
+
+
+def samples(decoded):
+    """Yields (age, {field: value}) with the values scaled, None if unknown."""
+    age, fields, scales, dt, rows = decoded
+    offset = 0
+    for delta, row in zip(dt, rows):
+        offset += delta
+        values = {f: (None if v is None else v / s) for f, s, v in zip(fields, scales, row)}
+        yield age - offset, values
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("file", nargs="?", help="payload file, stdin if omitted")
+    parser.add_argument("--hex", action="store_true", help="the input is hex text")
+    parser.add_argument("--json", action="store_true", help="print JSON lines instead of CSV")
+    args = parser.parse_args()
+
+    data = open(args.file, "rb").read() if args.file else sys.stdin.buffer.read()
+    if args.hex:
+        data = bytes.fromhex(data.decode("ascii"))
+
+    try:
+        encoding, decoded = decode(data)
+    except BatchError as error:
+        print("invalid batch: %s" % error, file=sys.stderr)
+        return 1
+
+    fields = decoded[1]
+    print("%s batch, %d samples, %d bytes, %.1f bytes per sample" %
+          (encoding, len(decoded[4]), len(data), len(data) / max(len(decoded[4]), 1)), file=sys.stderr)
+    if not args.json:
+        print(",".join(["age"] + list(fields)))
+    for age, values in samples(decoded):
+        if args.json:
+            print(json.dumps(dict(age=age, **values)))
+        else:
+            print(",".join([str(age)] + ["" if values[f] is None else "%g" % values[f] for f in fields]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())